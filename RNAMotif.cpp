@@ -42,6 +42,9 @@
 #include <omp.h>
 
 // C++ headers
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -50,7 +53,12 @@
 // App headers
 #include "folding_utils/RNAlib_utils.h"
 #include "folding_utils/IPknot_utils.h"
+#include "folding_utils/annotation_utils.h"
 #include "motif.h"
+#include "fold_workers.h"
+#include "fold_cache.h"
+#include "read_search.h"
+#include "family_pipeline.h"
 
 // reading the Stockholm format
 #include "stockholm_file.h"
@@ -172,17 +180,71 @@ parseCommandLine(AppOptions & options, int argc, char const ** argv)
 
     addOption(parser, seqan::ArgParseOption("ml", "max-length", "Maximum sequence length to fold", seqan::ArgParseOption::INTEGER));
     setDefaultValue(parser, "max-length", 1000);
+    addOption(parser, seqan::ArgParseOption("sp", "max-span", "Maximum distance of paired columns in all folding steps (0 = unlimited).", seqan::ArgParseOption::INTEGER));
+    setDefaultValue(parser, "max-span", 0);
+    setMinValue(parser, "max-span", "0");
+    addOption(parser, seqan::ArgParseOption("lw", "local-window", "Fold alignments longer than the maximum length locally with RNAlib with this maximum base pair span (0 = skip them, always skipped with --pseudoknot).", seqan::ArgParseOption::INTEGER));
+    setDefaultValue(parser, "local-window", 150);
+    addOption(parser, seqan::ArgParseOption("lf", "local-flank", "Score stem loops in a window with this many flanking columns instead of the whole alignment (-1 = off).", seqan::ArgParseOption::INTEGER));
+    setDefaultValue(parser, "local-flank", -1);
+    setMinValue(parser, "local-flank", "-1");
+    addOption(parser, seqan::ArgParseOption("mg", "max-gap", "Drop alignment columns with more gaps than this before folding (% as integer values).", seqan::ArgParseOption::INTEGER));
+    setDefaultValue(parser, "max-gap", 100);
+    setMinValue(parser, "max-gap", "0");
+    setMaxValue(parser, "max-gap", "100");
 
     addOption(parser, seqan::ArgParseOption("t", "threads", "Number of threads to use for motif extraction.", seqan::ArgParseOption::INTEGER));
     setDefaultValue(parser, "threads", 1);
+    addOption(parser, seqan::ArgParseOption("fw", "fold-workers", "Fold the alignments in this many separate processes, so crashes of the folding libraries only lose one alignment (0 = fold in threads).", seqan::ArgParseOption::INTEGER));
+    setDefaultValue(parser, "fold-workers", 0);
+    setMinValue(parser, "fold-workers", "0");
+    addOption(parser, seqan::ArgParseOption("fr", "fold-retries", "Number of times an alignment is folded again after its fold worker died.", seqan::ArgParseOption::INTEGER));
+    setDefaultValue(parser, "fold-retries", 1);
+    setMinValue(parser, "fold-retries", "0");
+    addOption(parser, seqan::ArgParseOption("fs", "fold-rows", "Maximum number of alignment rows used for folding, picked to cover the sequence diversity (0 = all rows).", seqan::ArgParseOption::INTEGER));
+    setDefaultValue(parser, "fold-rows", 0);
+    setMinValue(parser, "fold-rows", "0");
 
     addOption(parser, seqan::ArgParseOption("f", "freq", "Frequency threshold (% as integer values).", seqan::ArgParseOption::INTEGER));
     setDefaultValue(parser, "freq", 0);
 
     addOption(parser, seqan::ArgParseOption("m", "match-length", "Seed length.", seqan::ArgParseOption::INTEGER));
+    addOption(parser, seqan::ArgParseOption("o", "report", "Benchmark report with the counts, sensitivity, specificity and MCC per family and threshold.", seqan::ArgParseOption::STRING));
+    setDefaultValue(parser, "report", "benchmark.tsv");
+    addOption(parser, seqan::ArgParseOption("sc", "search-cache", "Directory to cache the stem loop hits in between runs.", seqan::ArgParseOption::STRING));
+    addOption(parser, seqan::ArgParseOption("fc", "fold-cache", "Directory to cache the folded motifs in between runs.", seqan::ArgParseOption::STRING));
 
     addOption(parser, seqan::ArgParseOption("ps", "pseudoknot", "Predict structure with IPknot to include pseuoknots."));
     addOption(parser, seqan::ArgParseOption("co", "constrain", "Constrain individual structures with the seed consensus structure."));
+    addOption(parser, seqan::ArgParseOption("an", "annotation", "Take the stem loops from the SS_cons annotation instead of folding the alignment."));
+    addOption(parser, seqan::ArgParseOption("ap", "annotation-probs", "Compute the stem loop probabilities in annotation mode (in windows of the local flank)."));
+    addOption(parser, seqan::ArgParseOption("sa", "sample-alternatives", "Add alternative stem loops covering likely hairpins, sampled from the partition function of the alignment."));
+    addOption(parser, seqan::ArgParseOption("ns", "samples", "Maximum number of structures sampled for the alternative stem loops.", seqan::ArgParseOption::INTEGER));
+    setDefaultValue(parser, "samples", 1000);
+    setMinValue(parser, "samples", "1");
+    addOption(parser, seqan::ArgParseOption("ol", "online", "Scan the genome without an index (for small targets)."));
+    addOption(parser, seqan::ArgParseOption("gw", "gap-wildcards", "Search gapped alignment columns as optional characters instead of one pattern per gap length."));
+    addOption(parser, seqan::ArgParseOption("hi", "half-index", "Find only this many hairpin-proximal seed columns in the index and verify the rest in the packed genome (0 = off).", seqan::ArgParseOption::INTEGER));
+    setDefaultValue(parser, "half-index", 0);
+    setMinValue(parser, "half-index", "0");
+    addOption(parser, seqan::ArgParseOption("so", "seed-order", "Only extend patterns as observed in the seed rows, using this many preceding positions (0 = off).", seqan::ArgParseOption::INTEGER));
+    setDefaultValue(parser, "seed-order", 0);
+    setMinValue(parser, "seed-order", "0");
+    setMaxValue(parser, "seed-order", std::to_string(MaxSeedOrder));
+    addOption(parser, seqan::ArgParseOption("se", "seed-edits", "Number of extensions per pattern not observed in the seed rows.", seqan::ArgParseOption::INTEGER));
+    setDefaultValue(parser, "seed-edits", 0);
+    setMinValue(parser, "seed-edits", "0");
+    addOption(parser, seqan::ArgParseOption("mz", "minimizer", "Look up the seeds in a minimizer table of the genome (for long seeds)."));
+    addOption(parser, seqan::ArgParseOption("mk", "minimizer-k", "k-mer length of the minimizer table.", seqan::ArgParseOption::INTEGER));
+    setDefaultValue(parser, "minimizer-k", 12);
+    setMinValue(parser, "minimizer-k", "4");
+    setMaxValue(parser, "minimizer-k", "31");
+    addOption(parser, seqan::ArgParseOption("rs", "reads", "Treat the genome file as (gzipped) FASTQ/FASTA read set and count the reads hit per family."));
+    addOption(parser, seqan::ArgParseOption("bs", "batch-size", "Number of reads searched at once in read set mode.", seqan::ArgParseOption::INTEGER));
+    setDefaultValue(parser, "batch-size", 100000);
+    setMinValue(parser, "batch-size", "1");
+    addOption(parser, seqan::ArgParseOption("rc", "read-counts", "Read and hit counts per family in read set mode.", seqan::ArgParseOption::STRING));
+    setDefaultValue(parser, "read-counts", "read_counts.txt");
     addOption(parser, seqan::ArgParseOption("q", "quiet", "Set verbosity to a minimum."));
     addOption(parser, seqan::ArgParseOption("v", "verbose", "Enable verbose output."));
     addOption(parser, seqan::ArgParseOption("vv", "very-verbose", "Enable very verbose output."));
@@ -201,6 +263,14 @@ parseCommandLine(AppOptions & options, int argc, char const ** argv)
 
     options.constrain  = isSet(parser, "constrain");
     options.pseudoknot = isSet(parser, "pseudoknot");
+    options.annotation = isSet(parser, "annotation");
+    options.annotation_probs = isSet(parser, "annotation-probs");
+    options.sample_alternatives = isSet(parser, "sample-alternatives");
+    getOptionValue(options.samples, parser, "samples");
+    options.online     = isSet(parser, "online");
+    options.reads      = isSet(parser, "reads");
+    options.minimizer  = isSet(parser, "minimizer");
+    options.gap_wildcards = isSet(parser, "gap-wildcards");
 
     // Extract option values.
     if (isSet(parser, "quiet"))
@@ -212,14 +282,40 @@ parseCommandLine(AppOptions & options, int argc, char const ** argv)
     seqan::getArgumentValue(options.rna_file, parser, 0);
     seqan::getArgumentValue(options.genome_file, parser, 1);
     getOptionValue(options.fold_length, parser, "max-length");
+    getOptionValue(options.max_bp_span, parser, "max-span");
+    getOptionValue(options.local_window, parser, "local-window");
+    getOptionValue(options.local_flank, parser, "local-flank");
     getOptionValue(options.threads, parser, "threads");
+    getOptionValue(options.fold_workers, parser, "fold-workers");
+    getOptionValue(options.fold_retries, parser, "fold-retries");
+    getOptionValue(options.fold_rows, parser, "fold-rows");
     getOptionValue(options.match_len, parser, "match-length");
     getOptionValue(options.reference_file, parser, "reference");
+    getOptionValue(options.search_cache, parser, "search-cache");
+    getOptionValue(options.fold_cache, parser, "fold-cache");
+    getOptionValue(options.report_file, parser, "report");
+    getOptionValue(options.batch_size, parser, "batch-size");
+    getOptionValue(options.read_counts_file, parser, "read-counts");
+    getOptionValue(options.minimizer_k, parser, "minimizer-k");
+    getOptionValue(options.half_index, parser, "half-index");
+    getOptionValue(options.seed_order, parser, "seed-order");
+    getOptionValue(options.seed_edits, parser, "seed-edits");
 
     int freq;
     getOptionValue(freq, parser, "freq");
     options.freq_threshold = ((double)freq)/100.0;
 
+    int max_gap;
+    getOptionValue(max_gap, parser, "max-gap");
+    options.max_gap_fraction = ((double)max_gap)/100.0;
+
+    // read batches are only searched with the FM index or the online scanner
+    if (options.reads && (options.minimizer || options.gap_wildcards || options.half_index > 0 ||
+                          options.seed_order > 0 || !seqan::empty(options.search_cache))){
+        std::cerr << "ERROR: --reads can't be combined with --minimizer, --gap-wildcards, --half-index, --seed-order or --search-cache.\n";
+        return seqan::ArgumentParser::PARSE_ERROR;
+    }
+
     return seqan::ArgumentParser::PARSE_OK;
 }
 
@@ -365,43 +461,54 @@ void outputStats(std::vector<Motif*> &motifs){
 	}
 }
 
-template<typename Out>
-void split(const std::string &s, char delim, Out result) {
-    std::stringstream ss;
-    ss.str(s);
-    std::string item;
-    while (std::getline(ss, item, delim)) {
-        *(result++) = item;
-    }
-}
+// Streaming parser for the benchmark table. Every line holds the fields
+// <family>/<seq nr>  <..k<ref nr>>  <seq name>  <start>  <end>
+// which are cut out of the line buffer in place, malformed lines are skipped.
+std::unordered_map<std::string, std::vector<RfamBenchRecord> > read_reference(seqan::CharString file, bool exclude_rev = true){
+	std::unordered_map<std::string, std::vector<RfamBenchRecord> > result;
 
+	std::ifstream infile(seqan::toCString(file));
+	std::string line;
 
-std::vector<std::string> split(const std::string &s, char delim) {
-    std::vector<std::string> elems;
-    split(s, delim, std::back_inserter(elems));
-    return elems;
-}
+	while (std::getline(infile, line)){
+		const char *fields[5];
+		size_t lengths[5];
+		unsigned n = 0;
 
+		const char *p = line.c_str();
+		while (n < 5){
+			while (*p && std::isspace((unsigned char)*p))
+				++p;
 
-std::unordered_map<std::string, std::vector<RfamBenchRecord> > read_reference(seqan::CharString file, bool exclude_rev = true){
-	std::unordered_map<std::string, std::vector<RfamBenchRecord> > result;
+			if (!*p)
+				break;
 
-	std::ifstream infile(seqan::toCString(file));
-	std::string ID, ref, seq, start, end;
-	while (infile >> ID >> ref >> seq >> start >> end)
-	{
-		RfamBenchRecord record;
+			fields[n] = p;
+			while (*p && !std::isspace((unsigned char)*p))
+				++p;
+
+			lengths[n] = p - fields[n];
+			++n;
+		}
 
-		std::vector<std::string> idsplit = split(ID, '/');
-		record.ID = idsplit[0];
-		record.seq_nr = std::stoi(idsplit[1]);
+		if (n < 5)
+			continue;
 
-		std::vector<std::string> refsplit = split(ref, 'k');
-		record.ref_nr = std::stoi(refsplit[1]);
+		const char *slash = static_cast<const char*>(std::memchr(fields[0], '/', lengths[0]));
+		const char *k     = static_cast<const char*>(std::memchr(fields[1], 'k', lengths[1]));
 
-		record.seq_name = seq;
-		record.start = std::stoi(start)-2;
-		record.end = std::stoi(end)-2;
+		if (slash == NULL || k == NULL)
+			continue;
+
+		RfamBenchRecord record;
+
+		record.ID.assign(fields[0], slash - fields[0]);
+		record.seq_nr = std::strtol(slash+1, NULL, 10);
+		record.ref_nr = std::strtol(k+1, NULL, 10);
+
+		record.seq_name.assign(fields[2], lengths[2]);
+		record.start = std::strtol(fields[3], NULL, 10)-2;
+		record.end = std::strtol(fields[4], NULL, 10)-2;
 
 		record.reverse = record.start > record.end;
 
@@ -410,8 +517,6 @@ std::unordered_map<std::string, std::vector<RfamBenchRecord> > read_reference(se
 		}
 
 		result[record.ID].push_back(record);
-		//std::cout << ID << "\t" << ref << "\t" << seq << "\t" << start << "\t" << end << "\n";
-		//std::cout << record.ID << "\t" << record.seq_nr << "\t" << record.ref_nr << "\t" << record.seq_name << "\t" << record.start << "\t" << record.end << "\n";
 	}
 
 	return result;
@@ -423,6 +528,98 @@ std::unordered_map<std::string, std::vector<RfamBenchRecord> > read_reference(se
 
 // Program entry point.
 
+// create the motif of a single alignment, NULL if the alignment is skipped
+Motif* foldMotif(seqan::StockholmRecord<TBaseAlphabet> const &record, AppOptions const &options){
+	std::cout << record.header.at("AC") << " : " << record.header.at("ID") << "\n";
+
+	// the annotated structure needs no folding, independent of the length
+	if (options.annotation){
+		if (record.seqence_information.count("SS_cons") == 0){
+			std::cout << "Alignment has no SS_cons annotation .. skipping.\n";
+			return NULL;
+		}
+
+		Motif* rna_motif = createMotif(record);
+		getConsensusStructure(*rna_motif, record, NULL, options, AnnotationFold());
+
+		return rna_motif;
+	}
+
+	int seq_len = record.seqences.begin()->second.length();
+	if (seq_len > options.fold_length){
+		// only RNAlib folds locally, IPknot skips long alignments
+		if (options.local_window <= 0 || options.pseudoknot){
+			std::cout << "Alignment has length " << seq_len << " > " << options.fold_length << " .. skipping"
+					  << (options.pseudoknot ? " (no local folding with IPknot).\n" : ".\n");
+			return NULL;
+		}
+
+		std::cout << "Alignment has length " << seq_len << " > " << options.fold_length << " .. folding locally with RNAlib"
+				  << (options.constrain ? " (without the SS_cons constraint).\n" : ".\n");
+
+		Motif* rna_motif = createMotif(record);
+		getLocalConsensusStructure(*rna_motif, record, options);
+
+		return rna_motif;
+	}
+
+	// convert Rfam WUSS structure to normal brackets to get a constraint
+	char *constraint_bracket = NULL;
+	if (options.constrain){
+		constraint_bracket = new char[record.seqence_information.at("SS_cons").length() + 1];
+		WUSStoPseudoBracket(record.seqence_information.at("SS_cons"), constraint_bracket);
+	}
+
+	/*
+	char * rfam_bracket = WUSStoPseudoBracket(record.seqence_information.at("SS_cons"), constraint_bracket);
+	TConsensusStructure rfam_inter;
+	bracketToInteractions(rfam_bracket, rfam_inter);
+
+	free(rfam_bracket);
+	*/
+
+	Motif* rna_motif = createMotif(record);
+
+	// create structure for the whole multiple alignment
+	std::cout << "Rfam:   " << record.seqence_information.at("SS_cons") << "\n";
+	//DEBUG_MSG("Rfam:   " << record.seqence_information.at("SS_cons"));
+
+	if (options.pseudoknot)
+		getConsensusStructure(*rna_motif, record, constraint_bracket, options, IPknotFold());
+	else
+		getConsensusStructure(*rna_motif, record, constraint_bracket, options, RNALibFold());
+
+	std::cout << "\n";
+
+	if (options.constrain)
+		delete[] constraint_bracket;
+
+	return rna_motif;
+}
+
+// fold a single alignment, or take its motif from the fold cache
+Motif* foldRecord(seqan::StockholmRecord<TBaseAlphabet> const &record, AppOptions const &options, FoldCache const &cache){
+	if (!cache.enabled())
+		return foldMotif(record, options);
+
+	uint64_t key = foldCacheKey(record, options);
+
+	Motif* cached = createMotif(record);
+	if (readCachedFold(*cached, cache.path(key), key)){
+		std::cout << record.header.at("AC") << " : " << record.header.at("ID") << " (cached)\n";
+		return cached;
+	}
+
+	delete cached;
+
+	Motif* rna_motif = foldMotif(record, options);
+
+	if (rna_motif != NULL && !writeCachedFold(*rna_motif, cache.path(key), key))
+		std::cerr << "Could not write the fold cache file " << cache.path(key) << "\n";
+
+	return rna_motif;
+}
+
 int main(int argc, char const ** argv)
 {
     // Parse the command line.
@@ -447,10 +644,29 @@ int main(int argc, char const ** argv)
                   << "VERBOSITY\t" << options.verbosity << '\n'
                   << "CONSTRAINT\t" << options.constrain << '\n'
 				  << "PSEUDOKNOTS\t" << options.pseudoknot << '\n'
+				  << "ANNOTATION\t" << options.annotation << " (probabilities " << options.annotation_probs << ")\n"
+				  << "ALTERNATIVES\t" << options.sample_alternatives << " (" << options.samples << " samples)\n"
+				  << "ONLINE   \t" << options.online << '\n'
+				  << "GAP WILDCARDS\t" << options.gap_wildcards << '\n'
+				  << "HALF INDEX\t" << options.half_index << '\n'
+				  << "SEED ORDER\t" << options.seed_order << " (" << options.seed_edits << " edits)\n"
+				  << "MINIMIZER\t" << options.minimizer << " (k=" << options.minimizer_k << ")\n"
+				  << "READS    \t" << options.reads << '\n'
+				  << "BATCH SIZE\t" << options.batch_size << '\n'
+				  << "READ COUNTS\t" << options.read_counts_file << '\n'
 				  << "MAX LENGTH\t" << options.fold_length << '\n'
+				  << "MAX SPAN \t" << options.max_bp_span << '\n'
+				  << "LOCAL WINDOW\t" << options.local_window << '\n'
+				  << "LOCAL FLANK\t" << options.local_flank << '\n'
+				  << "MAX GAPS \t" << options.max_gap_fraction << '\n'
+				  << "FOLD WORKERS\t" << options.fold_workers << " (" << options.fold_retries << " retries)\n"
+				  << "FOLD ROWS\t" << options.fold_rows << '\n'
 				  << "FREQUENCY\t" << options.freq_threshold << '\n'
 				  << "RNA      \t" << options.rna_file << '\n'
 				  << "REFERENCE\t" << options.reference_file << '\n'
+				  << "CACHE    \t" << options.search_cache << '\n'
+				  << "FOLD CACHE\t" << options.fold_cache << '\n'
+				  << "REPORT   \t" << options.report_file << '\n'
                   << "TARGET   \t" << options.genome_file << "\n\n";
 
         std::cout << "Data types\n"
@@ -468,6 +684,31 @@ int main(int argc, char const ** argv)
 
     omp_set_num_threads(options.threads);
 
+	// seed RNAlib's random number generator once, before folding in parallel
+	// (the samples of --sample-alternatives reseed it per alignment)
+	vrna_init_rand();
+
+	FoldCache fold_cache;
+	if (!initFoldCache(fold_cache, seqan::toCString(options.fold_cache))){
+		std::cerr << "Can't use " << options.fold_cache << " as fold cache directory.\n";
+		fold_cache.dir.clear();
+	}
+
+	// benchmark runs fold and search every family as soon as it is read, while
+	// the target sequences are read and indexed. Fold workers fork and read
+	// screening needs all motifs at once, these still run in phases.
+	if (options.fold_workers == 0 && !options.reads && options.reference_file != ""){
+		std::unordered_map<std::string, std::vector<RfamBenchRecord> > reference_pos = read_reference(options.reference_file);
+
+		uint64_t start = GetTimeMs64();
+
+		runFamilyPipeline(reference_pos, options,
+						  [&options, &fold_cache](seqan::StockholmRecord<TBaseAlphabet> const &record){ return foldRecord(record, options, fold_cache); });
+
+		std::cout << "Time: " << GetTimeMs64() - start << "ms \n";
+		return 0;
+	}
+
     std::vector<seqan::StockholmRecord<TBaseAlphabet> > records;
 
     uint64_t start = GetTimeMs64();
@@ -486,58 +727,24 @@ int main(int argc, char const ** argv)
 
 	std::vector<Motif*> motifs(records.size());
 
-	#pragma omp parallel for schedule(dynamic)
-	for (size_t k=0; k < records.size(); ++k){
-		seqan::StockholmRecord<TBaseAlphabet> const &record = records[k];
-
-
-		std::cout << record.header.at("AC") << " : " << record.header.at("ID") << "\n";
-
-		int seq_len = record.seqences.begin()->second.length();
-		if (seq_len > options.fold_length){
-			std::cout << "Alignment has length " << seq_len << " > " << options.fold_length << " .. skipping.\n";
-			continue;
-		}
-
-		// convert Rfam WUSS structure to normal brackets to get a constraint
-		char *constraint_bracket = NULL;
-		if (options.constrain){
-			constraint_bracket = new char[record.seqence_information.at("SS_cons").length() + 1];
-			WUSStoPseudoBracket(record.seqence_information.at("SS_cons"), constraint_bracket);
+	if (options.fold_workers > 0){
+		foldInWorkers(motifs, records, options.fold_workers, options.fold_retries,
+					  [&options, &fold_cache](seqan::StockholmRecord<TBaseAlphabet> const &record){ return foldRecord(record, options, fold_cache); });
+	}
+	else{
+		#pragma omp parallel for schedule(dynamic)
+		for (size_t k=0; k < records.size(); ++k){
+			motifs[k] = foldRecord(records[k], options, fold_cache);
 		}
+	}
 
-		/*
-		char * rfam_bracket = WUSStoPseudoBracket(record.seqence_information.at("SS_cons"), constraint_bracket);
-		TConsensusStructure rfam_inter;
-		bracketToInteractions(rfam_bracket, rfam_inter);
-
-		free(rfam_bracket);
-		*/
-
-
-		Motif* rna_motif = new Motif();
-		rna_motif->header = record.header;
-		rna_motif->seqence_information = record.seqence_information;
-		rna_motif->seedAlignment = record.alignment;
-
-		// create structure for the whole multiple alignment
-		std::cout << "Rfam:   " << record.seqence_information.at("SS_cons") << "\n";
-		//DEBUG_MSG("Rfam:   " << record.seqence_information.at("SS_cons"));
-
-		//#pragma omp critical
-
-		if (options.pseudoknot)
-			getConsensusStructure(*rna_motif, record, constraint_bracket, IPknotFold());
-		else
-			getConsensusStructure(*rna_motif, record, constraint_bracket, RNALibFold());
-
-		std::cout << "\n";
-
-		motifs[k] = rna_motif;
-
-		if (options.constrain)
-			free(constraint_bracket);
+	// read sets are only screened for family content, there is no reference to benchmark against
+	if (options.reads){
+		std::cout << "Screening the read set for the motifs.\n";
+		screenReads(motifs, options);
+		return 0;
 	}
+
 	std::unordered_map<std::string, std::vector<RfamBenchRecord> > reference_pos;
 	//outputStats(motifs);
 	if (options.reference_file != ""){
@@ -0,0 +1,153 @@
+// ==========================================================================
+//                             benchmark_report.h
+// ==========================================================================
+// Copyright (c) 2006-2016, Knut Reinert, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Knut Reinert or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL KNUT REINERT OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Your Name <your.email@example.net>
+// ==========================================================================
+
+
+// Collects the benchmark counts of all families and frequency thresholds in
+// memory. Every (threshold, family) task owns one slot, so the search threads
+// never synchronize; the report is written once after the search.
+
+#ifndef APPS_RNAMOTIF_BENCHMARK_REPORT_H_
+#define APPS_RNAMOTIF_BENCHMARK_REPORT_H_
+
+#include "motif_structures.h"
+
+// C++ headers
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// Forwards
+// ============================================================================
+
+// ============================================================================
+// Tags, Classes, Enums
+// ============================================================================
+
+struct BenchmarkMetrics{
+	bool valid = false;
+	std::string id;
+
+	long tn = 0;
+	long fp = 0;
+	long tp = 0;
+	long fn = 0;
+	long refs = 0;
+
+	double sensitivity() const {
+		return (tp + fn) > 0 ? (double)tp / (tp + fn) : 0;
+	}
+
+	double specificity() const {
+		return (tn + fp) > 0 ? (double)tn / (tn + fp) : 0;
+	}
+
+	// Matthews correlation coefficient, 0 if any of the marginals is empty
+	double mcc() const {
+		double denom = std::sqrt((double)(tp + fp) * (tp + fn) * (tn + fp) * (tn + fn));
+		return denom > 0 ? ((double)tp * tn - (double)fp * fn) / denom : 0;
+	}
+};
+
+struct BenchmarkReport{
+	std::vector<double> thresholds;
+	// metrics[threshold][motif]
+	std::vector<std::vector<BenchmarkMetrics> > metrics;
+
+	BenchmarkReport(std::vector<double> const &thresholds, unsigned n_motifs)
+		: thresholds(thresholds), metrics(thresholds.size(), std::vector<BenchmarkMetrics>(n_motifs)) {}
+};
+
+// ============================================================================
+// Metafunctions
+// ============================================================================
+
+// ============================================================================
+// Functions
+// ============================================================================
+
+// store the result vector of countStemloopHits() (tn, fp, tp, fn, #refs)
+void recordMetrics(BenchmarkReport &report, unsigned threshold, unsigned motif, std::string const &id, std::vector<int> const &result){
+	BenchmarkMetrics &m = report.metrics[threshold][motif];
+
+	m.valid = true;
+	m.id    = id;
+	m.tn    = result[0];
+	m.fp    = result[1];
+	m.tp    = result[2];
+	m.fn    = result[3];
+	m.refs  = result[4];
+}
+
+// Write one row per family and threshold and print the mean sensitivity,
+// specificity and MCC per threshold.
+bool writeBenchmarkReport(BenchmarkReport const &report, std::string const &path){
+	std::ofstream fout(path);
+
+	if (!fout){
+		std::cerr << "Can't write the benchmark report to " << path << "\n";
+		return false;
+	}
+
+	fout << "#ID\tfreq\tTN\tFP\tTP\tFN\trefs\tsensitivity\tspecificity\tMCC\n";
+
+	std::cout << "freq\tfamilies\tsensitivity\tspecificity\tMCC\n";
+
+	for (unsigned k=0; k < report.thresholds.size(); ++k){
+		double sens = 0, spec = 0, mcc = 0;
+		unsigned n = 0;
+
+		for (BenchmarkMetrics const &m : report.metrics[k]){
+			if (!m.valid)
+				continue;
+
+			fout << m.id << "\t" << report.thresholds[k] << "\t" << m.tn << "\t" << m.fp << "\t" << m.tp << "\t" << m.fn << "\t" << m.refs
+				 << "\t" << m.sensitivity() << "\t" << m.specificity() << "\t" << m.mcc() << "\n";
+
+			sens += m.sensitivity();
+			spec += m.specificity();
+			mcc  += m.mcc();
+			++n;
+		}
+
+		if (n > 0)
+			std::cout << report.thresholds[k] << "\t" << n << "\t" << sens/n << "\t" << spec/n << "\t" << mcc/n << "\n";
+	}
+
+	return true;
+}
+
+#endif  // #ifndef APPS_RNAMOTIF_BENCHMARK_REPORT_H_
@@ -0,0 +1,183 @@
+// ==========================================================================
+//                               family_pipeline.h
+// ==========================================================================
+// Copyright (c) 2006-2016, Knut Reinert, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Knut Reinert or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL KNUT REINERT OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Your Name <your.email@example.net>
+// ==========================================================================
+
+
+// Pipelined extraction and search of the families for the benchmark. Every
+// family is read, folded, searched and freed on its own, so folding and
+// searching of different families overlap. The target sequences are read
+// and indexed in a task running next to the folding. Only a window of
+// records is read ahead, a family's motif lives until its search is done,
+// and only the benchmark counts are kept for the report.
+
+#ifndef APPS_RNAMOTIF_FAMILY_PIPELINE_H_
+#define APPS_RNAMOTIF_FAMILY_PIPELINE_H_
+
+#include "motif_structures.h"
+#include "motif_search.h"
+#include "benchmark_report.h"
+#include "stockholm_file.h"
+
+// SeqAn headers
+#include <seqan/seq_io.h>
+
+// openMP
+#include <omp.h>
+
+// C++ headers
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// ============================================================================
+// Forwards
+// ============================================================================
+
+// ============================================================================
+// Tags, Classes, Enums
+// ============================================================================
+
+struct PipelineFamily{
+	std::string id;
+	Motif *motif = 0;
+	// results of searchFamily() per frequency threshold, empty if the
+	// family was not folded
+	std::vector<std::vector<int> > results;
+};
+
+// ============================================================================
+// Metafunctions
+// ============================================================================
+
+// ============================================================================
+// Functions
+// ============================================================================
+
+// Fold all families of options.rna_file with fold(record) and search them in
+// options.genome_file for the benchmark report. The records are read and
+// folded in windows of a few families per thread; the searches of a window
+// start as soon as its families are folded and the search space is built,
+// while the next window is folded.
+template <typename TFold>
+void runFamilyPipeline(std::unordered_map<std::string, std::vector<RfamBenchRecord> > const &refrecords, AppOptions const &options, TFold fold){
+	std::vector<double> freqs = benchmarkThresholds();
+
+	seqan::StockholmFileIn stockFileIn;
+	seqan::open(stockFileIn, seqan::toCString(options.rna_file));
+
+	seqan::StringSet<seqan::CharString> ids;
+	seqan::StringSet<seqan::String<TBaseAlphabet> > seqs;
+	FamilySearchSpace space;
+	// the searches depend on this, set up by the task building the search space
+	char search_ready = 0;
+
+	// a deque keeps the families in place while new ones are added
+	std::deque<PipelineFamily> families;
+	unsigned window = 4 * std::max(1u, options.threads);
+
+	#pragma omp parallel
+	#pragma omp single
+	{
+		#pragma omp task depend(out: search_ready)
+		{
+			seqan::SeqFileIn seqFileIn(seqan::toCString(options.genome_file));
+			seqan::readRecords(ids, seqs, seqFileIn);
+
+			std::cout << "Read reference DB with " << seqan::length(seqs) << " records\n";
+
+			initFamilySearchSpace(space, seqs, options);
+		}
+
+		while (!seqan::atEnd(stockFileIn)){
+			// no reallocation while the fold tasks refer to the records
+			std::vector<seqan::StockholmRecord<TBaseAlphabet> > records;
+			records.reserve(window);
+
+			std::vector<PipelineFamily*> window_families;
+
+			// the records of the window are freed once they are folded,
+			// the searches are not part of the task group
+			#pragma omp taskgroup
+			{
+				while (records.size() < window && !seqan::atEnd(stockFileIn)){
+					records.push_back(seqan::StockholmRecord<TBaseAlphabet>());
+					seqan::readRecord(records.back(), stockFileIn);
+
+					families.push_back(PipelineFamily());
+					PipelineFamily *family = &families.back();
+					seqan::StockholmRecord<TBaseAlphabet> const *record = &records.back();
+					window_families.push_back(family);
+
+					#pragma omp task
+					{
+						family->motif = fold(*record);
+
+						if (family->motif != 0)
+							family->id = family->motif->header.at("ID");
+					}
+				}
+			}
+
+			for (PipelineFamily *family : window_families){
+				if (family->motif == 0)
+					continue;
+
+				#pragma omp task depend(in: search_ready)
+				{
+					family->results = searchFamily(space, family->motif, freqs, refrecords, options);
+
+					delete family->motif;
+					family->motif = 0;
+				}
+			}
+		}
+	}
+
+	std::cout << families.size() << " records read\n";
+
+	std::vector<std::string> ids;
+	std::vector<std::vector<std::vector<int> > > results;
+
+	for (PipelineFamily &family : families){
+		ids.push_back(family.id);
+		results.push_back(std::move(family.results));
+	}
+
+	reportFamilies(space, freqs, ids, results, options);
+}
+
+#endif  // #ifndef APPS_RNAMOTIF_FAMILY_PIPELINE_H_
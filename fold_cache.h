@@ -0,0 +1,229 @@
+// ==========================================================================
+//                                fold_cache.h
+// ==========================================================================
+// Copyright (c) 2006-2016, Knut Reinert, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Knut Reinert or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL KNUT REINERT OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Your Name <your.email@example.net>
+// ==========================================================================
+
+// On-disk cache for the folding results of whole alignments. A cache file
+// holds everything the folding adds to a motif and is named after a hash of
+// the alignment rows, its consensus annotation and the folding options, so
+// rerunning the same seeds skips the folding completely.
+
+#ifndef APPS_RNAMOTIF_FOLD_CACHE_H_
+#define APPS_RNAMOTIF_FOLD_CACHE_H_
+
+#include "motif_structures.h"
+#include "search_cache.h"
+#include "fold_workers.h"
+#include "stockholm_file.h"
+
+// openMP
+#include <omp.h>
+
+// C++ headers
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// POSIX headers
+#include <unistd.h>
+
+// ============================================================================
+// Forwards
+// ============================================================================
+
+// ============================================================================
+// Tags, Classes, Enums
+// ============================================================================
+
+// bump whenever the folding itself or the layout of the fold results changes
+const uint32_t FoldCacheVersion = 1;
+const char FoldCacheMagic[4] = {'R', 'M', 'F', 'C'};
+
+struct FoldCache{
+	// directory holding the cache files, caching is disabled if empty
+	std::string dir;
+
+	bool enabled() const {
+		return !dir.empty();
+	}
+
+	std::string path(uint64_t key) const {
+		std::stringstream ss;
+		ss << dir << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".fold";
+		return ss.str();
+	}
+};
+
+// ============================================================================
+// Metafunctions
+// ============================================================================
+
+// ============================================================================
+// Functions
+// ============================================================================
+
+inline void fnvHashString(uint64_t &hash, std::string const &str){
+	fnvHashValue(hash, (uint64_t)str.size());
+	fnvHash(hash, str.data(), str.size());
+}
+
+// The local flank as the folding path of a record reads it, -1 where it is
+// not used, so changing it doesn't invalidate the other cached folds.
+int foldedFlank(AppOptions const &options, bool local){
+	if (options.annotation)
+		return options.annotation_probs ? std::max(0, options.local_flank) : -1;
+
+	// IPknot scores the stem loops without windows and never folds locally
+	if (options.pseudoknot)
+		return -1;
+
+	return local ? std::max(0, options.local_flank) : options.local_flank;
+}
+
+// hash everything the folding result of the record depends on
+template <typename TAlphabet>
+uint64_t foldCacheKey(seqan::StockholmRecord<TAlphabet> const &record, AppOptions const &options){
+	uint64_t hash = FNVOffset;
+
+	fnvHashValue(hash, FoldCacheVersion);
+
+	// fold tag and model parameters
+	bool local = (int)record.seqences.begin()->second.length() > options.fold_length;
+	fnvHashValue(hash, (uint8_t)options.pseudoknot);
+	fnvHashValue(hash, (uint8_t)options.constrain);
+	fnvHashValue(hash, (uint8_t)options.annotation);
+	fnvHashValue(hash, (uint8_t)options.annotation_probs);
+	fnvHashValue(hash, (uint8_t)options.sample_alternatives);
+	fnvHashValue(hash, options.sample_alternatives ? options.samples : 0);
+	fnvHashValue(hash, (uint8_t)local);
+	fnvHashValue(hash, local ? options.local_window : 0);
+	fnvHashValue(hash, foldedFlank(options, local));
+	fnvHashValue(hash, options.max_bp_span);
+	fnvHashValue(hash, options.fold_rows);
+	fnvHashValue(hash, options.max_gap_fraction);
+
+	// the constraint and the MCC are derived from the consensus annotation
+	auto ss_cons = record.seqence_information.find("SS_cons");
+	fnvHashString(hash, ss_cons != record.seqence_information.end() ? ss_cons->second : std::string());
+
+	fnvHashValue(hash, (uint64_t)record.sequence_names.size());
+	for (std::string const &name : record.sequence_names){
+		fnvHashString(hash, name);
+		fnvHashString(hash, record.seqences.at(name));
+	}
+
+	return hash;
+}
+
+bool initFoldCache(FoldCache &cache, std::string const &dir){
+	cache.dir = dir;
+
+	if (!cache.enabled())
+		return true;
+
+	return createCacheDirectory(dir);
+}
+
+// read the folding results into the motif, returns false if the file is
+// missing, damaged or does not belong to the key
+bool readCachedFold(Motif &motif, std::string const &path, uint64_t key){
+	std::ifstream fin(path, std::ios::binary);
+
+	if (!fin)
+		return false;
+
+	char magic[4];
+	uint32_t version;
+	uint64_t file_key, n;
+
+	fin.read(magic, 4);
+	fin.read(reinterpret_cast<char*>(&version), sizeof(version));
+	fin.read(reinterpret_cast<char*>(&file_key), sizeof(file_key));
+	fin.read(reinterpret_cast<char*>(&n), sizeof(n));
+
+	if (!fin || std::memcmp(magic, FoldCacheMagic, 4) != 0 || version != FoldCacheVersion || file_key != key)
+		return false;
+
+	// truncated or damaged file, don't trust n
+	if (n > remainingBytes(fin))
+		return false;
+
+	std::vector<char> buffer(n);
+	fin.read(buffer.data(), n);
+
+	// truncated file
+	if (!fin)
+		return false;
+
+	FoldResultReader reader(buffer.data(), n);
+	return readFoldResult(reader, motif);
+}
+
+// write into a temporary file first and rename it afterwards, so concurrent
+// readers either see the complete file or none at all
+bool writeCachedFold(Motif const &motif, std::string const &path, uint64_t key){
+	std::vector<char> buffer;
+	FoldResultWriter writer(buffer);
+	writeFoldResult(writer, motif);
+
+	std::stringstream tmp_path;
+	tmp_path << path << ".tmp." << getpid() << "." << omp_get_thread_num();
+
+	{
+		std::ofstream fout(tmp_path.str(), std::ios::binary | std::ios::trunc);
+
+		if (!fout)
+			return false;
+
+		uint64_t n = buffer.size();
+
+		fout.write(FoldCacheMagic, 4);
+		fout.write(reinterpret_cast<const char*>(&FoldCacheVersion), sizeof(FoldCacheVersion));
+		fout.write(reinterpret_cast<const char*>(&key), sizeof(key));
+		fout.write(reinterpret_cast<const char*>(&n), sizeof(n));
+		fout.write(buffer.data(), n);
+
+		if (!fout){
+			std::remove(tmp_path.str().c_str());
+			return false;
+		}
+	}
+
+	return std::rename(tmp_path.str().c_str(), path.c_str()) == 0;
+}
+
+#endif  // #ifndef APPS_RNAMOTIF_FOLD_CACHE_H_
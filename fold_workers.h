@@ -0,0 +1,525 @@
+// ==========================================================================
+//                               fold_workers.h
+// ==========================================================================
+// Copyright (c) 2006-2016, Knut Reinert, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Knut Reinert or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL KNUT REINERT OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Your Name <your.email@example.net>
+// ==========================================================================
+
+// Consensus folding in a pool of forked worker processes. Every alignment is
+// folded in its own child process, which writes the folding results of the
+// motif (stem loop profiles, external bases and MCC) into a shared memory
+// slot of the worker. A crash inside the folding libraries only takes down
+// that child, the alignment is then retried or skipped and the run goes on.
+
+#ifndef APPS_RNAMOTIF_FOLD_WORKERS_H_
+#define APPS_RNAMOTIF_FOLD_WORKERS_H_
+
+#include "motif_structures.h"
+#include "stockholm_file.h"
+
+// openMP
+#include <omp.h>
+
+// C++ headers
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <type_traits>
+#include <vector>
+
+// POSIX headers
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// ============================================================================
+// Forwards
+// ============================================================================
+
+// ============================================================================
+// Tags, Classes, Enums
+// ============================================================================
+
+// size of the shared memory slot of each worker, pages are only touched when
+// written, so this is mostly reserved address space
+const size_t FoldResultCapacity = 256*1024*1024;
+
+enum FoldResultStatus : uint32_t {FOLD_PENDING = 0, FOLD_DONE, FOLD_SKIPPED, FOLD_OVERFLOW};
+
+struct FoldResultHeader{
+	volatile uint32_t status;
+	uint64_t size;
+};
+
+// bounded writer into the shared memory slot of a worker, or a writer
+// appending to a growing buffer
+struct FoldResultWriter{
+	char *data = NULL;
+	size_t capacity = 0;
+	size_t size = 0;
+	bool overflow = false;
+
+	std::vector<char> *buffer = NULL;
+
+	FoldResultWriter(char *data, size_t capacity) : data(data), capacity(capacity) {};
+	FoldResultWriter(std::vector<char> &buffer) : buffer(&buffer) {};
+};
+
+struct FoldResultReader{
+	const char *data;
+	size_t size;
+	size_t pos = 0;
+	bool error = false;
+
+	FoldResultReader(const char *data, size_t size) : data(data), size(size) {};
+};
+
+struct FoldWorker{
+	pid_t pid = -1;
+	size_t job;
+	unsigned attempt;
+	char *slot = NULL;
+};
+
+// ============================================================================
+// Metafunctions
+// ============================================================================
+
+// ============================================================================
+// Functions
+// ============================================================================
+
+// motif with the alignment data of the record, but without any folding results
+template <typename TAlphabet>
+Motif* createMotif(seqan::StockholmRecord<TAlphabet> const &record){
+	Motif* rna_motif = new Motif();
+	rna_motif->header = record.header;
+	rna_motif->seqence_information = record.seqence_information;
+	rna_motif->seedAlignment = record.alignment;
+	rna_motif->seedWeights = collapsedRowWeights(rna_motif->seedAlignment);
+
+	return rna_motif;
+}
+
+// --------------------------------------------------------------------------
+// Serialization of the folding results
+// --------------------------------------------------------------------------
+
+void writeBytes(FoldResultWriter &writer, const void *data, size_t n){
+	if (writer.buffer != NULL){
+		const char *bytes = static_cast<const char*>(data);
+		writer.buffer->insert(writer.buffer->end(), bytes, bytes + n);
+		writer.size += n;
+		return;
+	}
+
+	if (writer.overflow || writer.size + n > writer.capacity){
+		writer.overflow = true;
+		return;
+	}
+
+	std::memcpy(writer.data + writer.size, data, n);
+	writer.size += n;
+}
+
+template <typename T>
+inline void writeValue(FoldResultWriter &writer, T const &value){
+	writeBytes(writer, &value, sizeof(T));
+}
+
+void readBytes(FoldResultReader &reader, void *data, size_t n){
+	if (reader.error || reader.pos + n > reader.size){
+		reader.error = true;
+		return;
+	}
+
+	std::memcpy(data, reader.data + reader.pos, n);
+	reader.pos += n;
+}
+
+template <typename T>
+inline T readValue(FoldResultReader &reader){
+	T value = T();
+	readBytes(reader, &value, sizeof(T));
+	return value;
+}
+
+template <typename TProfileString>
+void writeProfileString(FoldResultWriter &writer, TProfileString const &profile){
+	typedef typename seqan::Value<TProfileString>::Type TProfileChar;
+	const unsigned size = seqan::ValueSize<TProfileChar>::VALUE;
+
+	writeValue(writer, (uint64_t)seqan::length(profile));
+
+	for (unsigned i=0; i < seqan::length(profile); ++i){
+		for (unsigned c=0; c < size; ++c){
+			writeValue(writer, profile[i].count[c]);
+		}
+	}
+}
+
+template <typename TProfileString>
+void readProfileString(FoldResultReader &reader, TProfileString &profile){
+	typedef typename seqan::Value<TProfileString>::Type TProfileChar;
+	typedef typename std::remove_reference<decltype(TProfileChar().count[0])>::type TCount;
+	const unsigned size = seqan::ValueSize<TProfileChar>::VALUE;
+
+	uint64_t n = readValue<uint64_t>(reader);
+
+	// every profile character takes up at least one byte
+	if (reader.error || n > reader.size - reader.pos){
+		reader.error = true;
+		return;
+	}
+
+	seqan::resize(profile, n);
+
+	for (uint64_t i=0; i < n; ++i){
+		for (unsigned c=0; c < size; ++c){
+			profile[i].count[c] = readValue<TCount>(reader);
+		}
+	}
+}
+
+void writeStructureElement(FoldResultWriter &writer, StructureElement const &element){
+	writeValue(writer, (int32_t)element.type);
+	writeValue(writer, (uint8_t)element.loopLeft);
+	writeValue(writer, (int32_t)element.location);
+
+	writeProfileString(writer, element.loopComponents);
+	writeProfileString(writer, element.stemProfile);
+
+	writeValue(writer, (uint64_t)element.gap_lengths.size());
+	for (std::map<int, int> const &gaps : element.gap_lengths){
+		writeValue(writer, (uint64_t)gaps.size());
+
+		for (auto const &gap : gaps){
+			writeValue(writer, (int32_t)gap.first);
+			writeValue(writer, (int32_t)gap.second);
+		}
+	}
+
+	writeValue(writer, element.statistics.min_length);
+	writeValue(writer, element.statistics.max_length);
+	writeValue(writer, element.statistics.mean_length);
+}
+
+void readStructureElement(FoldResultReader &reader, StructureElement &element){
+	element.type = (StructureType)readValue<int32_t>(reader);
+	element.loopLeft = readValue<uint8_t>(reader);
+	element.location = readValue<int32_t>(reader);
+
+	readProfileString(reader, element.loopComponents);
+	readProfileString(reader, element.stemProfile);
+
+	uint64_t n_gaps = readValue<uint64_t>(reader);
+	for (uint64_t i=0; i < n_gaps && !reader.error; ++i){
+		std::map<int, int> gaps;
+		uint64_t n = readValue<uint64_t>(reader);
+
+		for (uint64_t j=0; j < n && !reader.error; ++j){
+			int first = readValue<int32_t>(reader);
+			gaps[first] = readValue<int32_t>(reader);
+		}
+
+		element.gap_lengths.push_back(gaps);
+	}
+
+	element.statistics.min_length = readValue<unsigned>(reader);
+	element.statistics.max_length = readValue<unsigned>(reader);
+	element.statistics.mean_length = readValue<double>(reader);
+}
+
+// the interactions span the whole alignment but are mostly unpaired,
+// so only the paired positions are stored
+void writeStemLoop(FoldResultWriter &writer, TStructure const &structure){
+	writeValue(writer, (int32_t)structure.suboptimal);
+	writeValue(writer, (int32_t)structure.btype);
+	writeValue(writer, (int32_t)structure.pos.first);
+	writeValue(writer, (int32_t)structure.pos.second);
+	writeValue(writer, structure.prob);
+
+	uint64_t n_pairs = 0;
+	for (int partner : structure.interactions)
+		n_pairs += (partner != -1);
+
+	writeValue(writer, (uint64_t)structure.interactions.size());
+	writeValue(writer, n_pairs);
+	for (size_t i=0; i < structure.interactions.size(); ++i){
+		if (structure.interactions[i] == -1)
+			continue;
+
+		writeValue(writer, (int32_t)i);
+		writeValue(writer, (int32_t)structure.interactions[i]);
+	}
+
+	writeValue(writer, (uint64_t)structure.elements.size());
+	for (StructureElement const &element : structure.elements)
+		writeStructureElement(writer, element);
+}
+
+void readStemLoop(FoldResultReader &reader, TStemLoopProfile &profile){
+	int suboptimal = readValue<int32_t>(reader);
+	BracketType btype = (BracketType)readValue<int32_t>(reader);
+	int first = readValue<int32_t>(reader);
+	int second = readValue<int32_t>(reader);
+
+	TStructure structure(btype, std::make_pair(first, second));
+	structure.suboptimal = suboptimal;
+	structure.prob = readValue<double>(reader);
+
+	uint64_t n_interactions = readValue<uint64_t>(reader);
+	uint64_t n_pairs = readValue<uint64_t>(reader);
+
+	if (reader.error || n_pairs > n_interactions || n_interactions > reader.size){
+		reader.error = true;
+		return;
+	}
+
+	structure.interactions.assign(n_interactions, -1);
+	for (uint64_t i=0; i < n_pairs && !reader.error; ++i){
+		uint32_t pos = readValue<int32_t>(reader);
+		int partner = readValue<int32_t>(reader);
+
+		if (pos >= n_interactions){
+			reader.error = true;
+			return;
+		}
+
+		structure.interactions[pos] = partner;
+	}
+
+	uint64_t n_elements = readValue<uint64_t>(reader);
+	for (uint64_t i=0; i < n_elements && !reader.error; ++i){
+		StructureElement element;
+		readStructureElement(reader, element);
+		structure.elements.push_back(element);
+	}
+
+	profile.push_back(structure);
+}
+
+// everything getConsensusStructure adds to the motif
+void writeFoldResult(FoldResultWriter &writer, Motif const &motif){
+	writeValue(writer, motif.mcc);
+
+	writeValue(writer, (uint64_t)motif.externalBases.size());
+	for (TLoopProfileString const &external : motif.externalBases)
+		writeProfileString(writer, external);
+
+	writeValue(writer, (uint64_t)motif.profile.size());
+	for (TStructure const &structure : motif.profile)
+		writeStemLoop(writer, structure);
+}
+
+bool readFoldResult(FoldResultReader &reader, Motif &motif){
+	motif.mcc = readValue<double>(reader);
+
+	uint64_t n_external = readValue<uint64_t>(reader);
+	for (uint64_t i=0; i < n_external && !reader.error; ++i){
+		TLoopProfileString external;
+		readProfileString(reader, external);
+		motif.externalBases.push_back(external);
+	}
+
+	uint64_t n_structures = readValue<uint64_t>(reader);
+	for (uint64_t i=0; i < n_structures && !reader.error; ++i)
+		readStemLoop(reader, motif.profile);
+
+	return !reader.error && reader.pos == reader.size;
+}
+
+// --------------------------------------------------------------------------
+// Worker pool
+// --------------------------------------------------------------------------
+
+// runs in the forked child, never returns
+template <typename TRecord, typename TFold>
+void runFoldWorker(FoldWorker &worker, TRecord const &record, TFold &fold){
+	FoldResultHeader *header = reinterpret_cast<FoldResultHeader*>(worker.slot);
+	FoldResultWriter writer(worker.slot + sizeof(FoldResultHeader), FoldResultCapacity - sizeof(FoldResultHeader));
+
+	// the OpenMP runtime is not fork-safe, the child never starts a team
+	omp_set_num_threads(1);
+
+	Motif *motif = fold(record);
+
+	if (motif == NULL){
+		header->status = FOLD_SKIPPED;
+	}
+	else{
+		writeFoldResult(writer, *motif);
+
+		header->size = writer.size;
+		header->status = writer.overflow ? FOLD_OVERFLOW : FOLD_DONE;
+	}
+
+	// skip the destructors and atexit handlers of the parent's state
+	std::cout.flush();
+	_exit(0);
+}
+
+// Fold all records in n_workers child processes. fold(record) returns the
+// folded motif or NULL if the record is skipped. Records whose worker dies
+// are folded again up to retries times, afterwards their motif stays NULL.
+template <typename TRecord, typename TFold>
+void foldInWorkers(std::vector<Motif*> &motifs, std::vector<TRecord> const &records, unsigned n_workers, unsigned retries, TFold fold){
+	std::vector<FoldWorker> workers(std::max(1u, n_workers));
+
+	for (FoldWorker &worker : workers){
+		void *slot = mmap(NULL, FoldResultCapacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+		if (slot == MAP_FAILED){
+			std::cerr << "Could not map the shared memory of the fold workers: " << std::strerror(errno) << "\n";
+			std::cerr << "Folding in the main process instead.\n";
+
+			for (FoldWorker &mapped : workers){
+				if (mapped.slot != NULL)
+					munmap(mapped.slot, FoldResultCapacity);
+			}
+
+			for (size_t k=0; k < records.size(); ++k)
+				motifs[k] = fold(records[k]);
+
+			return;
+		}
+
+		worker.slot = static_cast<char*>(slot);
+	}
+
+	// (record, attempt) pairs still to fold
+	std::deque<std::pair<size_t, unsigned> > jobs;
+	for (size_t k=0; k < records.size(); ++k)
+		jobs.push_back(std::make_pair(k, 0));
+
+	unsigned running = 0;
+
+	while (!jobs.empty() || running > 0){
+		// hand out jobs to all idle workers
+		for (FoldWorker &worker : workers){
+			if (worker.pid != -1 || jobs.empty())
+				continue;
+
+			worker.job = jobs.front().first;
+			worker.attempt = jobs.front().second;
+			jobs.pop_front();
+
+			FoldResultHeader *header = reinterpret_cast<FoldResultHeader*>(worker.slot);
+			header->status = FOLD_PENDING;
+			header->size = 0;
+
+			// buffered output would be written by both processes otherwise
+			std::cout.flush();
+
+			pid_t pid = fork();
+
+			if (pid == 0)
+				runFoldWorker(worker, records[worker.job], fold);
+
+			if (pid == -1){
+				std::cerr << "Could not fork a fold worker: " << std::strerror(errno) << ", folding in the main process.\n";
+				motifs[worker.job] = fold(records[worker.job]);
+				continue;
+			}
+
+			worker.pid = pid;
+			++running;
+		}
+
+		if (running == 0)
+			continue;
+
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+
+		if (pid == -1){
+			if (errno == EINTR)
+				continue;
+
+			std::cerr << "Waiting for the fold workers failed: " << std::strerror(errno) << "\n";
+			break;
+		}
+
+		auto it = std::find_if(workers.begin(), workers.end(), [pid](FoldWorker const &w){ return w.pid == pid; });
+		if (it == workers.end())
+			continue;
+
+		FoldWorker &worker = *it;
+		worker.pid = -1;
+		--running;
+
+		FoldResultHeader const *header = reinterpret_cast<FoldResultHeader const*>(worker.slot);
+		TRecord const &record = records[worker.job];
+		bool exited = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+		if (exited && header->status == FOLD_SKIPPED)
+			continue;
+
+		if (exited && header->status == FOLD_DONE){
+			Motif *motif = createMotif(record);
+			FoldResultReader reader(worker.slot + sizeof(FoldResultHeader), header->size);
+
+			if (readFoldResult(reader, *motif)){
+				motifs[worker.job] = motif;
+				continue;
+			}
+
+			delete motif;
+			std::cerr << "Corrupt fold result for " << record.header.at("AC") << ", skipping.\n";
+			continue;
+		}
+
+		if (exited && header->status == FOLD_OVERFLOW){
+			std::cerr << "Fold result for " << record.header.at("AC") << " exceeds the shared memory slot, skipping.\n";
+			continue;
+		}
+
+		std::cerr << "Fold worker for " << record.header.at("AC") << " died";
+		if (WIFSIGNALED(status))
+			std::cerr << " with signal " << WTERMSIG(status) << " (" << strsignal(WTERMSIG(status)) << ")";
+
+		if (worker.attempt < retries){
+			std::cerr << ", retrying.\n";
+			jobs.push_back(std::make_pair(worker.job, worker.attempt + 1));
+		}
+		else{
+			std::cerr << ", skipping.\n";
+		}
+	}
+
+	for (FoldWorker &worker : workers)
+		munmap(worker.slot, FoldResultCapacity);
+}
+
+#endif  // #ifndef APPS_RNAMOTIF_FOLD_WORKERS_H_
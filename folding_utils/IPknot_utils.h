@@ -507,14 +507,28 @@ output_fa(std::ostream& os,
 /* End of IPknot functions */
 
 // reads the multiple alignment sequences into the IPknot Aln object
-void getConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> const & record, const char* constraint, IPknotFold const &){
+void getConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> const & record, const char* constraint, AppOptions const &options, IPknotFold const &){
 	TConsensusStructure consensusStructure;
-	std::list<std::string> names;
-	std::list<std::string> seqs;
+	std::vector<std::string> rows;
 	for (std::string name : record.sequence_names){
-		names.push_back(name);
-		seqs.push_back(record.seqences.at(name));
+		rows.push_back(record.seqences.at(name));
+	}
+
+	// identical rows are folded once and weighted by their multiplicity
+	std::vector<double> row_weights;
+	rows = foldingRows(rows, options.fold_rows, row_weights);
+
+	// fold without the mostly gapped columns
+	size_t aln_length = rows[0].size();
+	std::vector<int> columns = foldingColumns(rows, row_weights, options.max_gap_fraction);
+	trimColumns(rows, columns);
+
+	std::list<std::string> names;
+	std::list<std::string> seqs(rows.begin(), rows.end());
+	for (size_t i=0; i < rows.size(); ++i){
+		names.push_back("row" + std::to_string(i));
 	}
+	std::vector<float> seq_weights(row_weights.begin(), row_weights.end());
 
 	//for (size_t i = 0; i < record.seqences.size(); ++i){
 		//names.push_back(record.seqNames[i]);
@@ -570,9 +584,10 @@ void getConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> c
 	const char* param=NULL;
 //
 
-    BPEngineSeq* e2 = new CONTRAfoldModel();
+    // the span limit applies to the ungapped sequences here
+    BPEngineSeq* e2 = new CONTRAfoldModel(std::max(0, options.max_bp_span));
     en_s.push_back(e2);
-    en_a.push_back(new AveragedModel(e2));
+    en_a.push_back(new AveragedModel(e2, seq_weights));
 
     //BPEngineSeq* e = new RNAfoldModel(param);
     //en_s.push_back(e);
@@ -583,6 +598,14 @@ void getConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> c
 	BPEngineAln* en= mix_en ? mix_en : en_a[0];
 	en->calculate_posterior(aln.seq(), bp, offset);
 
+	// drop pairs of columns further apart than the span limit
+	if (options.max_bp_span > 0){
+		uint L = aln.seq().front().size();
+		for (uint i=1; i <= L; ++i)
+			for (uint j=i+options.max_bp_span+1; j <= L; ++j)
+				bp[offset[i]+j] = 0;
+	}
+
 	std::vector<int> bpseq;
 
 	ipknot.solve(aln.size(), bp, offset, t, bpseq, plevel);
@@ -596,10 +619,11 @@ void getConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> c
 	make_interaction_pairs(bpseq, plevel, consensusStructure);
 
 	std::cout << "IPknot: " << make_parenthesis(bpseq, plevel) << "\n";
+	consensusStructure = expandConsensusStructure(consensusStructure, columns, aln_length);
 	TStemLoopProfile stemLoops = findStemLoops(consensusStructure);
 
 	for (auto& pair : stemLoops){
-		partitionStemLoop(motif.seedAlignment, pair);
+		partitionStemLoop(motif.seedAlignment, motif.seedWeights, pair);
 
 		pair.prob = 1;
 
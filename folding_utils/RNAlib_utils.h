@@ -39,8 +39,12 @@
 #include "../motif.h"
 #include "../stockholm_file.h"
 
+#include <algorithm>
 #include <functional>
+#include <iterator>
+#include <map>
 #include <stack>
+#include <string>
 
 // Import RNAlib. 'extern "C"', since it's a C library
 extern "C"{
@@ -247,47 +251,56 @@ bool checkMatch(TStructure& region, short *strucTab){
 	return true;
 }
 
+struct CandidatePair{
+	int i;
+	int j;
+};
+
+// Hairpin candidates as (i, j, l): (i, j) is the innermost pair of a helix of
+// pairs with a probability above the threshold, l its number of stacked
+// pairs (limited to the sequence ends). Only the innermost helix of every
+// diagonal i+j is kept, hairpinKeys holds the diagonals in increasing order.
+// The pairs are taken from the sparse pair list instead of scanning the
+// diagonals of the whole probability matrix.
 void getHairpinCandidates(std::unordered_map<int, std::tuple<int,int,int> > &hairpins, std::vector<int> &hairpinKeys, vrna_fold_compound_t *vc, double threshold){
-	double* probs = vc->exp_matrices->probs;
-	int *iindex = vc->iindx;
-	unsigned length = vc->length;
-
-	// locate potential hairpins
-	// iterate along the matrix diagonals
-	// TODO: i = 0 happens at the start?
-	for (unsigned k=1; k<length; k++){
-		for (int offset=0; offset <= 1; ++offset){
-			int i = k-1+offset;
-			int j = k+1;
-
-			bool inHairpin = false;
+	int length = vc->length;
 
-			std::tuple<int,int,int> hairpin;
+	vrna_plist_t *plist = vrna_plist_from_probs(vc, threshold);
 
-			// scan the diagonal upwards
-			while (i > 0 && j <= length){
-				FLT_OR_DBL prob = (float)probs[iindex[i] - j];
+	std::vector<CandidatePair> pairs;
+	for (vrna_plist_t *pl = plist; pl->i != 0 || pl->j != 0; ++pl){
+		if (pl->type == VRNA_PLIST_TYPE_BASEPAIR && pl->p > threshold)
+			pairs.push_back({pl->i, pl->j});
+	}
+	free(plist);
+
+	// along each diagonal from the inside out
+	std::sort(pairs.begin(), pairs.end(), [](CandidatePair const &a, CandidatePair const &b){
+		return (a.i + a.j) < (b.i + b.j) || ((a.i + a.j) == (b.i + b.j) && a.i > b.i);
+	});
+
+	size_t p = 0;
+	while (p < pairs.size()){
+		int k = pairs[p].i + pairs[p].j;
+		int i = pairs[p].i;
+		int j = pairs[p].j;
+
+		// stack the helix
+		int l = 1;
+		size_t q = p+1;
+		while (q < pairs.size() && pairs[q].i + pairs[q].j == k && pairs[q].i == i-l){
+			++l;
+			++q;
+		}
 
-				if (prob > threshold && !inHairpin){
-					inHairpin = true;
-					hairpin = std::make_tuple(i,j,1);
-				}
+		hairpins[k] = std::make_tuple(i, j, std::min(l, std::min(i-1, length-j)));
+		hairpinKeys.push_back(k);
 
-				if (prob < threshold && inHairpin){
-					std::get<2>(hairpin) = j-std::get<1>(hairpin);
-					break;
-				}
+		// skip the outer helices of the diagonal
+		while (q < pairs.size() && pairs[q].i + pairs[q].j == k)
+			++q;
 
-				i -= 1;
-				j += 1;
-			}
-
-			if (inHairpin){
-				int k = std::get<0>(hairpin) + std::get<1>(hairpin);
-				hairpins[k] = hairpin;
-				hairpinKeys.push_back(k);
-			}
-		}
+		p = q;
 	}
 }
 
@@ -298,198 +311,435 @@ void append_char_array(std::vector<char *> &structures, char *structure, size_t
 	structures.push_back(tmp);
 }
 
-TStemLoopProfile enforceHairpins(Motif &motif, std::unordered_map<int, std::tuple<int,int,int> > &hairpins, std::vector<int> &hairpinKeys, vrna_fold_compound_t *vc, char **seqs, std::vector<char *> &structures){
-	bool skipEnforce = true;
+// Columns [start, end) of the innermost stem of a stem loop and its hairpin
+// loop, in the coordinates of its interactions (as the last stem and hairpin
+// of partitionStemLoop, which also ends a stem at a bulge on the right side).
+std::pair<int, int> innermostHairpin(TStructure const &stemLoop){
+	TInteractions const &consensus = stemLoop.interactions;
+
+	// opening bracket of the innermost pair
+	int inner = stemLoop.pos.first;
+	for (int i=stemLoop.pos.first; i <= stemLoop.pos.second; ++i){
+		if (consensus[i] > i)
+			inner = i;
+		else if (consensus[i] != -1)
+			break;
+	}
 
-	double* probs = vc->exp_matrices->probs;
-	int *iindex = vc->iindx;
-	unsigned length = vc->length;
+	// left side of the innermost stem, up to the next outer bulge on either side
+	int start = inner;
+	while (start > stemLoop.pos.first && consensus[start-1] > start-1 && consensus[consensus[start-1]-1] != -1)
+		--start;
 
-	char *structure = (char*)vrna_alloc(sizeof(char) * (length + 1));
-	vrna_mfe(vc, structure);
-	append_char_array(structures, structure, length);
+	return std::make_pair(start, consensus[start]+1);
+}
 
-	TStemLoopProfile result_regions;
+// Check whether the hairpin of the stem loop overlaps any of the candidate
+// hairpins. The candidates it overlaps are covered and erased.
+bool coverHairpins(TStructure const &stemLoop, std::unordered_map<int, std::tuple<int,int,int> > &hairpins){
+	int hairpinStart, hairpinEnd;
+	std::tie(hairpinStart, hairpinEnd) = innermostHairpin(stemLoop);
+
+	bool covered = false;
+
+	for (auto hairpin = hairpins.begin(); hairpin != hairpins.end();){
+		int i,j,l;
+		std::tie(i,j,l) = hairpin->second;
+		bool overlaps = false;
+
+		int posi = i-l;
+		int posj = j+l;
+
+		// check if the hairpin region overlaps with the stem loop
+		for (int off=0; off <= l; ++off){
+			if ((hairpinStart <= (posi+off) && (posi+off) < hairpinEnd && hairpinEnd <= (posj-off)) ||
+				((posi+off) <=hairpinStart && hairpinStart < (posj-off) && (posj-off) <= hairpinEnd)){
+				overlaps = true;
+				break;
+			}
+		}
+
+		if (overlaps){
+			covered = true;
+			hairpin = hairpins.erase(hairpin);
+		}
+		else
+			++hairpin;
+	}
+
+	return covered;
+}
+
+// Add the stem loops of structure that cover candidate hairpins to the result.
+void addCoveringStemLoops(std::unordered_map<int, std::tuple<int,int,int> > &hairpins, const char *structure, int suboptimal, TStemLoopProfile &result_regions, std::vector<char *> &structures){
 	TConsensusStructure consensusStructure;
 	structureToInteractions(structure, consensusStructure);
 	TStemLoopProfile stemLoops = findStemLoops(consensusStructure);
 
+	bool added = false;
 	for (auto stemLoop : stemLoops){
-		std::cout << "Setting 0 \n";
-		stemLoop.suboptimal = 0;
+		if (!coverHairpins(stemLoop, hairpins))
+			continue;
+
+		stemLoop.suboptimal = suboptimal;
+		result_regions.push_back(stemLoop);
+		added = true;
+	}
+
+	if (added)
+		append_char_array(structures, const_cast<char*>(structure), strlen(structure));
+}
+
+// Seed of the samples of one alignment, a hash over its folded rows, so the
+// samples don't depend on the other alignments folded before or in parallel.
+uint64_t samplingSeed(char **seqs){
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t k=0; seqs[k] != 0; ++k){
+		for (const char *c = seqs[k]; *c; ++c){
+			hash ^= (unsigned char)*c;
+			hash *= 1099511628211ULL;
+		}
 	}
 
+	return hash;
+}
+
+// Stem loops of the MFE structure and, with samples > 0, of alternative
+// structures covering the candidate hairpins. The alternatives are drawn by
+// stochastic backtracking from the partition function already computed in
+// vc, so no further energy minimization is needed per candidate; at most
+// samples structures are drawn, or until all candidates are covered. The
+// stem loops are in the columns of vc and not partitioned yet.
+TStemLoopProfile enforceHairpins(std::unordered_map<int, std::tuple<int,int,int> > &hairpins, vrna_fold_compound_t *vc, unsigned samples, uint64_t seed, std::vector<char *> &structures){
+	bool skipEnforce = (samples == 0);
+
+	unsigned length = vc->length;
+
+	char *structure = (char*)vrna_alloc(sizeof(char) * (length + 1));
+	vrna_mfe(vc, structure);
+
+	TStemLoopProfile result_regions;
+
 	if (skipEnforce){
+		append_char_array(structures, structure, length);
+
+		TConsensusStructure consensusStructure;
+		structureToInteractions(structure, consensusStructure);
+		TStemLoopProfile stemLoops = findStemLoops(consensusStructure);
+
 		for (auto stemLoop : stemLoops){
 			result_regions.push_back(stemLoop);
 		}
 
+		free(structure);
 		return result_regions;
 	}
 
-	vrna_plist_t *pl1, *pl2;
-	bool first = true;
-
-	//int attempts = 0;
-
-	// iteratively enforce most likely bases from hairpins that haven't been encountered yet
-	do {
-		// create new structure
-		if (!first){
-			int k = hairpinKeys.back();
-			hairpinKeys.pop_back();
-
-			int i,j,l;
-			std::tie(i,j,l) = hairpins[k];
-
-			// enforce base pair with highest probability in hairpin
-			int maxi, maxj;
-			float maxp = -1;
-
-			for (int off=0; off <= l; ++off){
-				FLT_OR_DBL prob = (float)probs[iindex[i-off] - (j+off)];
-				if (prob > maxp){
-					maxp = prob;
-					maxi = i-off;
-					maxj = j+off;
-				}
-			}
-			std::cout << "Fuck you mfe\n";
+	addCoveringStemLoops(hairpins, structure, 0, result_regions, structures);
+	free(structure);
 
-			/*
-			{
-			vrna_md_t md;
-			vrna_md_set_default(&md);
-			md.uniq_ML = 1;
-			md.ribo = 1;
+	std::unordered_set<std::string> seen;
 
+	// vrna_pbacktrack draws from RNAlib's process-global generator, it is
+	// seeded per alignment and only used by one thread at a time, so the
+	// samples are the same in every run independent of the threads
+	#pragma omp critical(rnalib_sampling)
+	{
+		xsubi[0] = seed & 0xffff;
+		xsubi[1] = (seed >> 16) & 0xffff;
+		xsubi[2] = (seed >> 32) & 0xffff;
 
-			vrna_fold_compound_t *vc2 	= vrna_fold_compound_comparative((const char**)seqs, &md, VRNA_OPTION_MFE | VRNA_OPTION_PF);
-			//std::cout << "Enforcing " << maxi << " " << maxj << "\n";
-			vrna_hc_add_bp(vc2, maxi, maxj, VRNA_CONSTRAINT_CONTEXT_ALL_LOOPS | VRNA_CONSTRAINT_CONTEXT_ENFORCE);
-			vrna_mfe(vc2, structure);
+		for (unsigned k=0; k < samples && !hairpins.empty(); ++k){
+			char *sample = vrna_pbacktrack(vc);
 
-			//vrna_fold_compound_free(vc2);
-			}
-			*/
+			if (!sample)
+				break;
 
+			if (seen.insert(sample).second)
+				addCoveringStemLoops(hairpins, sample, 1, result_regions, structures);
 
-			vrna_hc_init(vc);
-			std::cout << "Enforcing " << maxi << " " << maxj << "\n";
-			vrna_hc_add_bp(vc, maxi, maxj, VRNA_CONSTRAINT_CONTEXT_ALL_LOOPS | VRNA_CONSTRAINT_CONTEXT_ENFORCE);
-			vrna_mfe(vc, structure);
+			free(sample);
+		}
+	}
 
-			std::cout << "End mfe\n";
-			//std::cout << "Vienna: " << structure << "\n";
+	return result_regions;
+}
 
-			structureToInteractions(structure, consensusStructure);
-			stemLoops = findStemLoops(consensusStructure);
+// thermal energy in kcal/mol for the model details of a single fold compound
+double boltzmannKT(vrna_md_t const &md){
+	return (md.betaScale*((md.temperature+K0)*GASCONST))/1000.;
+}
 
-			for (auto pair : stemLoops){
-				std::cout << pair.pos.first << " " << pair.pos.second << "\n";
-			}
-		}
+// Rescale the Boltzmann factors of vc to its minimum free energy to avoid
+// overflows. The scaling factor is only stored in the (copied) exp parameters
+// of vc, the global pf_scale and temperature of RNAlib are never touched,
+// so fold compounds can be used in parallel.
+void rescalePartitionFunction(vrna_fold_compound_t *vc, vrna_md_t &md, int n_seq, double min_en){
+	vrna_exp_param_t *pf_parameters = vrna_exp_params_comparative(n_seq, &md);
+	pf_parameters->pf_scale = std::exp(-(md.sfact*min_en)/boltzmannKT(md)/vc->length);
+
+	// vc keeps a copy of the parameters
+	vrna_exp_params_subst(vc, pf_parameters);
+	free(pf_parameters);
+}
 
-		std::vector<TConsensusStructure> structureVariants;
+// comparative fold compound of the alignment columns [start, start+len)
+vrna_fold_compound_t* subAlignmentCompound(char **seqs, int n_seq, vrna_md_t &md, int start, int len){
+	std::vector<std::string> sub_alignment(n_seq);
+	char** sub_seqs = new char*[n_seq+1];
+	sub_seqs[n_seq] = 0;
 
-		// check with which hairpins our stemLoops overlap
-		for (auto stemLoop : stemLoops){
-			partitionStemLoop(motif.seedAlignment, stemLoop);
-
-			StructureElement &hairpinStem = stemLoop.elements[stemLoop.elements.size()-2];
-			int hairpinStart = hairpinStem.location;
-			int hairpinEnd = hairpinStart + seqan::length(hairpinStem.loopComponents[0])
-										  + seqan::length(stemLoop.elements.back().loopComponents[0])
-										  + seqan::length(hairpinStem.loopComponents[1]);
-
-			//std::cout << hairpinStart << " -- " << hairpinEnd << "\n";
-
-			bool stemAdded = false;
-			std::unordered_map<int, std::tuple<int,int,int> > tmpHairpin = hairpins;
-			for (auto hairpin : tmpHairpin){
-				int k = hairpin.first;
-				int i,j,l;
-				std::tie(i,j,l) = hairpin.second;
-
-				int posi = i-l;
-				int posj = j+l;
-
-				//std::cout << "Testing " << i << " " << j << "\n";
-
-				// check if the hairpin region overlaps with any stemloop
-				for (int off=0; off <= l; ++off){
-					// if overlap -> partition and save among the motifs
-					if ((stemLoop.pos.first < posi+off) && (posj-off < stemLoop.pos.second)){
-						//std::cout << stemLoop.pos.first << "-" << stemLoop.pos.second << " overlaps " << (posi+off) << "-" << (posj-off) << "\n";
-						//std::cout << hairpinStart << " " << hairpinEnd << "-" << (posi+off) << " " << (posj-off) << "\n";
-					}
-					if ((hairpinStart <= (posi+off) && (posi+off) < hairpinEnd && hairpinEnd <= (posj-off)) ||
-						((posi+off) <=hairpinStart && hairpinStart < (posj-off) && (posj-off) <= hairpinEnd)){
-						//std::cout << hairpinStart << " " << hairpinEnd << " overlaps" << (posi+off) << "-" << (posj-off) << "\n";
-
-						if (!stemAdded){
-							stemAdded = true;
-							//std::cout << "Added loop " << stemLoop.pos.first << " " << stemLoop.pos.second << "\n";
-							if (first){
-								stemLoop.suboptimal = 0;
-							}
-							else if (stemLoop.suboptimal == -1){
-								stemLoop.suboptimal = 1;
-							}
-
-							result_regions.push_back(stemLoop);
-							append_char_array(structures, structure, length);
-
-							//pl1 = vrna_plist_from_probs(vc, 0.005);
-							//pl2 = vrna_plist(structure, 0.95*0.95);
-
-							//char *tmp = (char*)("hairpin" + std::to_string(k) + std::string(".ps")).c_str();
-							//(void) PS_dot_plot_list((char*)consens_mis((const char**)vc->sequences), tmp, pl1, pl2, structure);
-
-						}
-
-						//std::cout << "Hairpin " << k << " from: (" << i-l << "," << j+l << ") to (" << i << "," << j << ")\n";
-
-						hairpins.erase(k);
-						hairpinKeys.erase(std::remove(hairpinKeys.begin(), hairpinKeys.end(), k), hairpinKeys.end());
-
-						break;
-					}
-				}
-			}
-		}
+	for (int i=0; i < n_seq; ++i){
+		sub_alignment[i] = std::string(seqs[i] + start, len);
+		sub_seqs[i] = &sub_alignment[i][0];
+	}
 
-		first = false;
+	// the fold compound keeps its own copy of the sequences
+	vrna_fold_compound_t *sub = vrna_fold_compound_comparative((const char**)sub_seqs, &md, VRNA_OPTION_MFE | VRNA_OPTION_PF);
+	delete[] sub_seqs;
 
-		// TODO: Actually enforce hairpins.
-		//break;
+	return sub;
+}
 
-	} while (!hairpins.empty() && !hairpinKeys.empty());
+// Ratio of the partition functions of sub without and with the stem loop
+// pairs in the columns [start, start+len) of the alignment enforced. The
+// hard constraints already set in sub are kept.
+double enforcedStemLoopRatio(vrna_fold_compound_t *sub, vrna_md_t &md, int n_seq, TStructure &stemLoop, int start, int len){
+	char *sub_structure = (char*)vrna_alloc(sizeof(char) * (len + 1));
+	double sub_mfe = vrna_mfe(sub, sub_structure);
+	rescalePartitionFunction(sub, md, n_seq, sub_mfe);
 
-	free(structure);
+	double open_energy = vrna_pf(sub, NULL);
 
-	return result_regions;
+	char* stemLoopStruc = interactionsToStructure(stemLoop.interactions, stemLoop.pos.first, stemLoop.pos.second);
+	stemLoopStruc[start+len] = 0;
+
+	vrna_constraints_add(sub, stemLoopStruc + start, VRNA_CONSTRAINT_DB | VRNA_CONSTRAINT_DB_DOT | VRNA_CONSTRAINT_DB_RND_BRACK | VRNA_CONSTRAINT_DB_ENFORCE_BP);
+	double closed_energy = vrna_pf(sub, NULL);
+
+	free(stemLoopStruc);
+	free(sub_structure);
+
+	return std::exp((open_energy-closed_energy)/boltzmannKT(md));
 }
 
-void getConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> const & record, const char* constraint, RNALibFold const &){
-	int n_seq = record.seqences.size();
-   	char** seqs = new char*[n_seq+1];
-   	seqs[n_seq] = 0;
-
-   	{
-		int i = 0;
-		for (auto elem : record.seqences)
-		{
-			// TODO: Get row out of the alignment object? (not always Stockholm)
-			seqs[i] = new char[elem.second.size()+1];
-			std::strcpy(seqs[i], elem.second.c_str());
-			++i;
-		}
-   	}
+// Probability that all base pairs of the stem loop form at once. The outermost
+// pair (i,j) is read from the base pair probabilities of vc. Given (i,j), only
+// the columns in between decide whether the inner pairs form, so the remaining
+// factor is the ratio of two partition functions of the sub-alignment [i,j]
+// with (i,j) enforced, once without and once with the inner pairs enforced.
+// This costs O((j-i)^3) instead of another partition function of the whole
+// alignment per stem loop.
+double stemLoopProbability(vrna_fold_compound_t *vc, char **seqs, int n_seq, vrna_md_t const &md, TStructure &stemLoop){
+	int first = stemLoop.pos.first;
+	int second = stemLoop.pos.second;
+	int sub_len = second - first + 1;
+
+	FLT_OR_DBL outer_prob = vc->exp_matrices->probs[vc->iindx[first+1] - (second+1)];
+	if (outer_prob <= 0)
+		return 0;
+
+	// only the ensemble free energies are needed
+	vrna_md_t sub_md = md;
+	sub_md.compute_bpp = 0;
+
+	vrna_fold_compound_t *sub = subAlignmentCompound(seqs, n_seq, sub_md, first, sub_len);
+	vrna_hc_add_bp(sub, 1, sub_len, VRNA_CONSTRAINT_CONTEXT_ALL_LOOPS | VRNA_CONSTRAINT_CONTEXT_ENFORCE);
+
+	double prob = outer_prob * enforcedStemLoopRatio(sub, sub_md, n_seq, stemLoop, first, sub_len);
+	vrna_fold_compound_free(sub);
+
+	return prob;
+}
+
+// Local variant of stemLoopProbability: the probability of the stem loop in
+// the ensemble of the alignment window [pos.first-flank, pos.second+flank]
+// only, with base pairs spanning at most the stem loop plus the flank (or the
+// span limit of md, if shorter). It
+// does not need the partition function of the whole alignment, so the cost
+// only depends on the size of the stem loop.
+double localStemLoopProbability(char **seqs, int n_seq, int length, vrna_md_t const &md, TStructure &stemLoop, int flank){
+	int start = std::max(0, stemLoop.pos.first - flank);
+	int end = std::min(length-1, stemLoop.pos.second + flank);
+	int window_len = end - start + 1;
+
+	vrna_md_t window_md = md;
+	window_md.compute_bpp = 0;
+	int span = stemLoop.pos.second - stemLoop.pos.first + 1 + flank;
+	window_md.max_bp_span = (md.max_bp_span > 0) ? std::min(md.max_bp_span, span) : span;
+
+	vrna_fold_compound_t *window = subAlignmentCompound(seqs, n_seq, window_md, start, window_len);
+
+	double prob = enforcedStemLoopRatio(window, window_md, n_seq, stemLoop, start, window_len);
+	vrna_fold_compound_free(window);
+
+	return prob;
+}
+
+// Rows of the alignment to fold as 0-terminated array of C strings for RNAlib.
+// Comparative folding has no sequence weights, so all rows are folded as they
+// are (identical rows included) unless max_rows > 0 asks for a subsample of
+// at most max_rows distinct rows (see foldingRows). Columns with a gap
+// fraction above max_gap_fraction are dropped, columns holds the original
+// index of every remaining column.
+char** alignmentSequences(seqan::StockholmRecord<TBaseAlphabet> const & record, unsigned max_rows, double max_gap_fraction, int &n_seq, std::vector<int> &columns){
+	// TODO: Get row out of the alignment object? (not always Stockholm)
+	std::vector<std::string> rows;
+	for (std::string const &name : record.sequence_names)
+		rows.push_back(record.seqences.at(name));
+
+	std::vector<double> weights(rows.size(), 1);
+	if (max_rows > 0)
+		rows = foldingRows(rows, max_rows, weights);
+
+	columns = foldingColumns(rows, weights, max_gap_fraction);
+	trimColumns(rows, columns);
+
+	n_seq = rows.size();
+	char** seqs = new char*[n_seq+1];
+	seqs[n_seq] = 0;
+
+	for (int i=0; i < n_seq; ++i){
+		seqs[i] = new char[rows[i].size()+1];
+		std::strcpy(seqs[i], rows[i].c_str());
+	}
+
+	return seqs;
+}
+
+// all columns of the alignment
+char** alignmentSequences(seqan::StockholmRecord<TBaseAlphabet> const & record, unsigned max_rows, int &n_seq){
+	std::vector<int> columns;
+	return alignmentSequences(record, max_rows, 1, n_seq, columns);
+}
+
+void freeAlignmentSequences(char** seqs){
+	// the sequence array is terminated with a 0 at the end
+	for (size_t k = 0; seqs[k] != 0; ++k)
+		delete[] seqs[k];
+
+	delete[] seqs;
+}
+
+struct LocalStructure{
+	int start;
+	int end;
+	float energy;
+	std::string structure;
+};
+
+void collectLocalStructure(int start, int end, const char *structure, float en, void *data){
+	std::vector<LocalStructure> *structures = static_cast<std::vector<LocalStructure>*>(data);
+	structures->push_back({start, end, en, std::string(structure, end-start+1)});
+}
+
+// Consensus structure of the whole alignment from the locally optimal
+// structures of a sliding window (as RNALalifold). Local structures are
+// taken by increasing energy as long as they don't overlap any structure
+// taken before.
+std::string localConsensusStructure(char **seqs, int length, vrna_md_t &md){
+	vrna_fold_compound_t *vc = vrna_fold_compound_comparative((const char**)seqs, &md, VRNA_OPTION_MFE | VRNA_OPTION_WINDOW);
+
+	std::vector<LocalStructure> local;
+	vrna_mfe_window_cb(vc, &collectLocalStructure, &local);
+	vrna_fold_compound_free(vc);
+
+	std::sort(local.begin(), local.end(), [](LocalStructure const &a, LocalStructure const &b){ return a.energy < b.energy; });
+
+	std::string structure(length, '.');
+
+	// taken intervals, start -> end
+	std::map<int, int> taken;
+
+	for (LocalStructure const &l : local){
+		auto next = taken.lower_bound(l.start);
+		if (next != taken.end() && next->first <= l.end)
+			continue;
+		if (next != taken.begin() && std::prev(next)->second >= l.start)
+			continue;
+
+		taken[l.start] = l.end;
+		structure.replace(l.start-1, l.structure.size(), l.structure);
+	}
+
+	return structure;
+}
+
+// Fold alignments that are too long for global comparative folding. The
+// consensus structure is assembled from local structures with a base pair
+// span of at most the local window and the stem loops are scored in windows
+// with the local flank, so the cost is O(L*W^2) instead of O(L^3).
+void getLocalConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> const & record, AppOptions const &options){
+	int window = options.local_window;
+	if (options.max_bp_span > 0)
+		window = std::min(window, options.max_bp_span);
+
+	int n_seq;
+	std::vector<int> columns;
+	char** seqs = alignmentSequences(record, options.fold_rows, options.max_gap_fraction, n_seq, columns);
+	int length = strlen(seqs[0]);
+	size_t aln_length = record.seqences.at(record.sequence_names[0]).size();
+
+	vrna_md_t md;
+	vrna_md_set_default(&md);
+	md.uniq_ML = 1;
+	md.ribo = 1;
+	md.window_size = std::min(window, length);
+	md.max_bp_span = md.window_size;
+
+	std::string structure = localConsensusStructure(seqs, length, md);
+
+	TConsensusStructure consensusStructure;
+	structureToInteractions(structure.c_str(), consensusStructure);
+	TStemLoopProfile stemLoops = findStemLoops(consensusStructure);
+
+	// window partition functions only, the whole alignment is never folded globally
+	md.window_size = length;
+	md.max_bp_span = (options.max_bp_span > 0) ? options.max_bp_span : -1;
+
+	// tasks for the idle threads of the enclosing team (families are folded
+	// in parallel already), run in order outside of a parallel region
+	#pragma omp taskloop grainsize(1)
+	for (size_t k=0; k < stemLoops.size(); ++k){
+		stemLoops[k].prob = localStemLoopProbability(seqs, n_seq, length, md, stemLoops[k], std::max(0, options.local_flank));
+	}
+
+	// back to the columns of the seed alignment
+	structure = expandStructure(structure, columns, aln_length);
+	std::cout << "Local:  " << structure << "\n";
+
+	consensusStructure = expandConsensusStructure(consensusStructure, columns, aln_length);
+	motif.externalBases = getExternal(consensusStructure, motif.seedAlignment, motif.seedWeights);
+
+	char *rfam_structure = new char[motif.seqence_information.at("SS_cons").length() + 1];
+	WUSStoPseudoBracket(motif.seqence_information.at("SS_cons"), rfam_structure);
+	motif.mcc = compute_MCC(rfam_structure, const_cast<char*>(structure.c_str()));
+	delete[] rfam_structure;
+
+	for (auto& pair : stemLoops){
+		expandStemLoop(pair, columns, aln_length);
+		partitionStemLoop(motif.seedAlignment, motif.seedWeights, pair);
+	}
+
+	std::cout << "Regions (" << stemLoops.size() << ")\n";
+	for (auto& pair : stemLoops){
+		std::cout << pair.pos.first << " " << pair.pos.second <<  " " << pair.prob << "\n";
+	}
+
+	motif.profile = stemLoops;
+
+	freeAlignmentSequences(seqs);
+}
+
+void getConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> const & record, const char* constraint, AppOptions const &options, RNALibFold const &){
+	int n_seq;
+	std::vector<int> columns;
+   	char** seqs = alignmentSequences(record, options.fold_rows, options.max_gap_fraction, n_seq, columns);
+	size_t aln_length = record.seqences.at(record.sequence_names[0]).size();
 
    	// ****** Set up ViennaRNA parameters
 
-	vrna_init_rand();
 	int length = strlen(seqs[0]);
 
 	char *structure  	 = (char*)vrna_alloc(sizeof(char) * (length + 1));
@@ -499,33 +749,25 @@ void getConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> c
 	vrna_md_set_default(&md);
 	md.uniq_ML = 1;
 	md.ribo = 1;
+	if (options.max_bp_span > 0)
+		md.max_bp_span = options.max_bp_span;
 	vrna_fold_compound_t *vc 	= vrna_fold_compound_comparative((const char**)seqs, &md, VRNA_OPTION_MFE | VRNA_OPTION_PF);
 
-	// add constraints if available
+	// add constraints if available, in the columns that are folded
 	if (constraint){
-		vrna_constraints_add(vc, constraint, VRNA_CONSTRAINT_DB | VRNA_CONSTRAINT_DB_DOT | VRNA_CONSTRAINT_DB_RND_BRACK);
-		std::cout << "bracket:" << constraint << std::endl;
+		std::string folded_constraint = projectStructure(constraint, columns);
+		vrna_constraints_add(vc, folded_constraint.c_str(), VRNA_CONSTRAINT_DB | VRNA_CONSTRAINT_DB_DOT | VRNA_CONSTRAINT_DB_RND_BRACK);
+		std::cout << "bracket:" << folded_constraint << std::endl;
 	}
 
 	// Compute minimum free energy
 	double min_en = vrna_mfe(vc, structure);
 
-	float energy, kT, sfact;
-	float betaScale = 1.;
-
-	// scaling parameters
-	kT = (betaScale*((temperature+K0)*GASCONST))/1000.; /* in Kcal */
-	vrna_exp_param_t  *pf_parameters;
-	sfact         = 1.07;
+	float energy;
+	double kT = boltzmannKT(md);
 
-	pf_scale = std::exp(-(sfact*min_en)/kT/length);
-
-    /* rescale energy parameters according to above calculated pf_scale */
-    pf_parameters = vrna_exp_params_comparative(n_seq, &md);
-    pf_parameters->pf_scale = pf_scale;
-
-    /* change energy parameters in vc */
-    vrna_exp_params_subst(vc, pf_parameters);
+	// scaling parameters, rescale energy parameters in vc to the mfe
+	rescalePartitionFunction(vc, md, n_seq, min_en);
 
     // ****************************************************************
 
@@ -535,7 +777,8 @@ void getConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> c
     // Find stem loops
     TConsensusStructure consensusStructure;
 	structureToInteractions(structure, consensusStructure);
-	motif.externalBases = getExternal(consensusStructure, motif.seedAlignment);
+	// external bases in the columns of the seed alignment
+	motif.externalBases = getExternal(expandConsensusStructure(consensusStructure, columns, aln_length), motif.seedAlignment, motif.seedWeights);
 	TStemLoopProfile stemLoops = findStemLoops(consensusStructure);
 
 	for (auto pair : stemLoops){
@@ -561,10 +804,10 @@ void getConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> c
 	std::unordered_map<int, std::tuple<int,int,int> > hairpins;
 	std::vector<int> hairpinKeys;
 
-	std::vector<FLT_OR_DBL> diagonals(2*n, -1);
-
+	// the candidates are only needed to pick the sampled alternatives
 	double threshold = 0.2;
-	getHairpinCandidates(hairpins, hairpinKeys, vc, threshold);
+	if (options.sample_alternatives)
+		getHairpinCandidates(hairpins, hairpinKeys, vc, threshold);
 
 	/*
 	std::cout << "Candidates:\n";
@@ -578,7 +821,9 @@ void getConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> c
 
 	std::vector<char *> structures;
 
-	TStemLoopProfile result_regions = enforceHairpins(motif, hairpins, hairpinKeys, vc, seqs, structures);
+	// alternative structures are sampled from the partition function of vc
+	unsigned samples = options.sample_alternatives ? options.samples : 0;
+	TStemLoopProfile result_regions = enforceHairpins(hairpins, vc, samples, samplingSeed(seqs), structures);
 
 	std::cout << structures.size() << " SIZE\n";
 	for (char * struc : structures){
@@ -592,7 +837,16 @@ void getConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> c
     rfam_structure = new char[motif.seqence_information.at("SS_cons").length() + 1];
     WUSStoPseudoBracket(motif.seqence_information.at("SS_cons"), rfam_structure);
 
-    motif.mcc = compute_MCC(rfam_structure, structures);
+    std::vector<char *> expanded_structures;
+    for (char * struc : structures){
+    	std::string expanded = expandStructure(struc, columns, aln_length);
+    	append_char_array(expanded_structures, &expanded[0], aln_length);
+    }
+
+    motif.mcc = compute_MCC(rfam_structure, expanded_structures);
+
+    for (char * struc : expanded_structures)
+    	delete[] struc;
 
     for (char * struc : structures)
     	free(struc);
@@ -600,51 +854,38 @@ void getConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> c
     free(rfam_structure);
     // ********************************************************
 
-	vrna_hc_init(vc);
-	vrna_pf(vc, NULL);
-
-	// assign probabilities to the hairpins we found
+	// assign probabilities to the hairpins we found, the base pair
+	// probabilities of vc are still those of the first partition function
 	// get dot plot structures
 	vrna_plist_t *pl1, *pl2;
 	//pl1 = vrna_plist_from_probs(vc, 0.005);
 	//pl2 = vrna_plist(structure, 0.95*0.95);
 
+	// the stem loops are scored independently of each other, as tasks for the
+	// idle threads of the team folding the families
+	#pragma omp taskloop grainsize(1)
+	for (size_t k=0; k < result_regions.size(); ++k){
+		// local_flank >= 0 scores the stem loops in windows with this many flanking
+		// columns instead of in the ensemble of the whole alignment
+		if (options.local_flank >= 0)
+			result_regions[k].prob = localStemLoopProbability(seqs, n_seq, length, md, result_regions[k], options.local_flank);
+		else
+			result_regions[k].prob = stemLoopProbability(vc, seqs, n_seq, md, result_regions[k]);
+	}
+
 	std::cout << "Regions (" << result_regions.size() << ")\n";
 	for (auto& pair : result_regions){
-		partitionStemLoop(motif.seedAlignment, pair);
-
-		//pair.countProb /= boltzmann_samples;
-		vrna_fold_compound_t *vc2 	= vrna_fold_compound_comparative((const char**)seqs, &md, VRNA_OPTION_MFE | VRNA_OPTION_PF);
+		expandStemLoop(pair, columns, aln_length);
+		partitionStemLoop(motif.seedAlignment, motif.seedWeights, pair);
+	}
 
+	for (auto& pair : result_regions){
 		char* stemLoopStruc = interactionsToStructure(pair.interactions, pair.pos.first, pair.pos.second);
-
 		std::cout << "       " << stemLoopStruc << "\n";
-
-		// scaling parameters
-		kT = (betaScale*((temperature+K0)*GASCONST))/1000.; // in Kcal
-		vrna_exp_param_t  *pf_parameters;
-		sfact         = 1.07;
-
-		pf_scale = std::exp(-(sfact*min_en)/kT/length);
-
-	    // rescale energy parameters according to above calculated pf_scale
-	    pf_parameters = vrna_exp_params_comparative(n_seq, &md);
-	    pf_parameters->pf_scale = pf_scale;
-
-	    // change energy parameters in vc
-	    vrna_exp_params_subst(vc2, pf_parameters);
-
-		vrna_constraints_add(vc2, stemLoopStruc, VRNA_CONSTRAINT_DB | VRNA_CONSTRAINT_DB_DOT | VRNA_CONSTRAINT_DB_RND_BRACK | VRNA_CONSTRAINT_DB_ENFORCE_BP);
-
-		double sub_energy = vrna_pf(vc2, prob_structure);
-		std::cout << "       " << prob_structure << " " << sub_energy << "\n";
-
-		pair.prob = std::exp((energy-sub_energy)/kT);
+		free(stemLoopStruc);
 
 		std::cout << pair.pos.first << " " << pair.pos.second <<  " " << pair.prob << "\n";
 
-		vrna_fold_compound_free(vc2);
-
 		std::cout << "------ \n";
 	}
 
@@ -665,10 +906,7 @@ void getConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> c
 	free(prob_structure);
 	vrna_fold_compound_free(vc);
 
-	// free the sequence array (terminated with a 0 at the end)
-	for (size_t k = 0; seqs[k] != 0; ++k)
-		free(seqs[k]);
-
-	free(seqs);}
+	freeAlignmentSequences(seqs);
+}
 
 #endif  // #ifndef APPS_RNAMOTIF_RNALIB_UTILS_H_
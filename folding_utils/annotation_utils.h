@@ -0,0 +1,118 @@
+// ==========================================================================
+//                            annotation_utils.h
+// ==========================================================================
+// Copyright (c) 2006-2016, Knut Reinert, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Knut Reinert or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL KNUT REINERT OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Your Name <your.email@example.net>
+// ==========================================================================
+
+// Motifs straight from the curated Rfam consensus structure (SS_cons),
+// without folding the alignment.
+
+#ifndef APPS_RNAMOTIF_ANNOTATION_UTILS_H_
+#define APPS_RNAMOTIF_ANNOTATION_UTILS_H_
+
+#include "../motif_structures.h"
+#include "../motif.h"
+#include "../stockholm_file.h"
+#include "RNAlib_utils.h"
+
+// ============================================================================
+// Forwards
+// ============================================================================
+
+// ============================================================================
+// Tags, Classes, Enums
+// ============================================================================
+
+// ============================================================================
+// Metafunctions
+// ============================================================================
+
+// ============================================================================
+// Functions
+// ============================================================================
+
+// Build the stem loops from SS_cons. Pseudoknotted pairs (letters in WUSS)
+// are dropped by the conversion to brackets. The stem loop probabilities need
+// partition functions and are only computed when asked for, in windows of the
+// local flank around each stem loop; otherwise they are 1 as for IPknot.
+void getConsensusStructure(Motif &motif, seqan::StockholmRecord<TBaseAlphabet> const & record, const char* /*constraint*/, AppOptions const &options, AnnotationFold const &){
+	std::string const &ss_cons = record.seqence_information.at("SS_cons");
+
+	char *bracket = new char[ss_cons.length() + 1];
+	WUSStoPseudoBracket(ss_cons, bracket);
+
+	std::cout << "SS_cons: " << bracket << "\n";
+
+	TConsensusStructure consensusStructure;
+	bracketToInteractions(bracket, consensusStructure);
+	delete[] bracket;
+
+	motif.externalBases = getExternal(consensusStructure, motif.seedAlignment, motif.seedWeights);
+	TStemLoopProfile stemLoops = findStemLoops(consensusStructure);
+
+	// the structure is the reference itself
+	motif.mcc = 1;
+
+	for (auto& pair : stemLoops){
+		partitionStemLoop(motif.seedAlignment, motif.seedWeights, pair);
+		pair.prob = 1;
+	}
+
+	if (options.annotation_probs && !stemLoops.empty()){
+		int n_seq;
+		char** seqs = alignmentSequences(record, options.fold_rows, n_seq);
+		int length = strlen(seqs[0]);
+
+		vrna_md_t md;
+		vrna_md_set_default(&md);
+		md.uniq_ML = 1;
+		md.ribo = 1;
+		if (options.max_bp_span > 0)
+			md.max_bp_span = options.max_bp_span;
+
+		// tasks for the idle threads of the team folding the families
+		#pragma omp taskloop grainsize(1)
+		for (size_t k=0; k < stemLoops.size(); ++k){
+			stemLoops[k].prob = localStemLoopProbability(seqs, n_seq, length, md, stemLoops[k], std::max(0, options.local_flank));
+		}
+
+		freeAlignmentSequences(seqs);
+	}
+
+	std::cout << "Regions (" << stemLoops.size() << ")\n";
+	for (auto& pair : stemLoops){
+		std::cout << pair.pos.first << " " << pair.pos.second << " " << pair.prob << "\n";
+	}
+
+	motif.profile = stemLoops;
+}
+
+#endif  // #ifndef APPS_RNAMOTIF_ANNOTATION_UTILS_H_
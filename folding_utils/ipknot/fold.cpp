@@ -75,9 +75,9 @@ calculate_posterior(const std::string& seq, std::vector<float>& bp, std::vector<
 {
   SStruct ss("unknown", seq);
   ParameterManager<float> pm;
-  InferenceEngine<float> en(false);
+  InferenceEngine<float> en(false, max_bp_dist_);
   std::vector<float> w = GetDefaultComplementaryValues<float>();
-  bp.resize((seq.size()+1)*(seq.size()+2)/2, 0.0);
+  // GetPosterior sizes bp, only the band with max_bp_dist_ > 0
   en.RegisterParameters(pm);
   en.LoadValues(w);
   en.LoadSequence(ss);
@@ -94,9 +94,9 @@ calculate_posterior(const std::string& seq, const std::string& paren,
 {
   SStruct ss("unknown", seq, paren);
   ParameterManager<float> pm;
-  InferenceEngine<float> en(false);
+  InferenceEngine<float> en(false, max_bp_dist_);
   std::vector<float> w = GetDefaultComplementaryValues<float>();
-  bp.resize((seq.size()+1)*(seq.size()+2)/2, 0.0);
+  // GetPosterior sizes bp, only the band with max_bp_dist_ > 0
   en.RegisterParameters(pm);
   en.LoadValues(w);
   en.LoadSequence(ss);
@@ -348,6 +348,15 @@ calculate_posterior(const std::list<std::string>& aln,
 }
 
 // Averaged model
+float
+AveragedModel::
+weight(uint k, uint N) const
+{
+  if (w_.empty()) return 1.0/N;
+  assert(w_.size()==N);
+  return w_[k];
+}
+
 void
 AveragedModel::
 calculate_posterior(const std::list<std::string>& aln,
@@ -359,7 +368,8 @@ calculate_posterior(const std::list<std::string>& aln,
   offset.resize(L+1);
   for (uint i=0; i<=L; ++i)
     offset[i] = i*((L+1)+(L+1)-i-1)/2;
-  for (std::list<std::string>::const_iterator s=aln.begin(); s!=aln.end(); ++s)
+  uint k=0;
+  for (std::list<std::string>::const_iterator s=aln.begin(); s!=aln.end(); ++s, ++k)
   {
     std::vector<float> lbp;
     std::vector<int> loffset;
@@ -374,9 +384,14 @@ calculate_posterior(const std::list<std::string>& aln,
       }
     }
     en_->calculate_posterior(seq, lbp, loffset);
+    // with a maximum distance the engine's inside/outside recursions and its
+    // posterior only cover the band j-i <= w, pairs outside of it are not
+    // stored; the averaged matrix over the alignment columns stays triangular
+    uint w=en_->max_bp_dist();
+    float wk=weight(k, N);
     for (uint i=0; i!=seq.size()-1; ++i)
-      for (uint j=i+1; j!=seq.size(); ++j)
-        bp[offset[idx[i]+1]+(idx[j]+1)] += lbp[loffset[i+1]+(j+1)]/N;
+      for (uint j=i+1; j!=seq.size() && (w==0 || j-i<=w); ++j)
+        bp[offset[idx[i]+1]+(idx[j]+1)] += lbp[loffset[i+1]+(j+1)]*wk;
   }
 }
 
@@ -414,7 +429,8 @@ calculate_posterior(const std::list<std::string>& aln, const std::string& paren,
   for (uint i=0; i<=L; ++i)
     offset[i] = i*((L+1)+(L+1)-i-1)/2;
   std::vector<int> p = bpseq(paren);
-  for (std::list<std::string>::const_iterator s=aln.begin(); s!=aln.end(); ++s)
+  uint k=0;
+  for (std::list<std::string>::const_iterator s=aln.begin(); s!=aln.end(); ++s, ++k)
   {
     std::vector<float> lbp;
     std::vector<int> loffset;
@@ -443,9 +459,14 @@ calculate_posterior(const std::list<std::string>& aln, const std::string& paren,
     }
       
     en_->calculate_posterior(seq, lparen, lbp, loffset);
+    // with a maximum distance the engine's inside/outside recursions and its
+    // posterior only cover the band j-i <= w, pairs outside of it are not
+    // stored; the averaged matrix over the alignment columns stays triangular
+    uint w=en_->max_bp_dist();
+    float wk=weight(k, N);
     for (uint i=0; i!=seq.size()-1; ++i)
-      for (uint j=i+1; j!=seq.size(); ++j)
-        bp[offset[idx[i]+1]+(idx[j]+1)] += lbp[loffset[i+1]+(j+1)]/N;
+      for (uint j=i+1; j!=seq.size() && (w==0 || j-i<=w); ++j)
+        bp[offset[idx[i]+1]+(idx[j]+1)] += lbp[loffset[i+1]+(j+1)]*wk;
   }
 }
 
@@ -39,6 +39,9 @@ public:
 
   virtual void calculate_posterior(const std::string& seq, const std::string& paren,
                                    std::vector<float>& bp, std::vector<int>& offset) const = 0;
+
+  // maximum distance of base pairs in the posterior, 0 if unlimited
+  virtual int max_bp_dist() const { return 0; }
 };
 
 // The base class for calculating base-pairing probabilities of aligned sequences
@@ -57,12 +60,17 @@ public:
 class CONTRAfoldModel : public BPEngineSeq
 {
 public:
-  CONTRAfoldModel() : BPEngineSeq() { }
+  CONTRAfoldModel(int max_bp_dist=0) : BPEngineSeq(), max_bp_dist_(max_bp_dist) { }
 
   void calculate_posterior(const std::string& seq, std::vector<float>& bp, std::vector<int>& offset) const;
 
   void calculate_posterior(const std::string& seq, const std::string& paren,
                            std::vector<float>& bp, std::vector<int>& offset) const;
+
+  int max_bp_dist() const { return max_bp_dist_; }
+
+private:
+  int max_bp_dist_;
 };
 
 class RNAfoldModel : public BPEngineSeq
@@ -110,7 +118,15 @@ public:
 class AveragedModel : public BPEngineAln
 {
 public:
-  AveragedModel(BPEngineSeq* en) : en_(en) { }
+  // w holds one weight per sequence of the alignment (equal weights if empty),
+  // the weights are normalized to sum up to 1
+  AveragedModel(BPEngineSeq* en, const std::vector<float>& w = std::vector<float>())
+    : en_(en), w_(w)
+  {
+    float sum=0.0;
+    for (uint i=0; i!=w_.size(); ++i) sum+=w_[i];
+    for (uint i=0; i!=w_.size(); ++i) w_[i]/=sum;
+  }
 
   void calculate_posterior(const std::list<std::string>& aln,
                            std::vector<float>& bp, std::vector<int>& offset) const;
@@ -118,8 +134,12 @@ public:
   void calculate_posterior(const std::list<std::string>& aln, const std::string& paren,
                            std::vector<float>& bp, std::vector<int>& offset) const;
 
+private:
+  float weight(uint k, uint N) const;
+
 private:
   BPEngineSeq* en_;
+  std::vector<float> w_;
 };
 
 class MixtureModel : public BPEngineAln
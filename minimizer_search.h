@@ -0,0 +1,384 @@
+// ==========================================================================
+//                             minimizer_search.h
+// ==========================================================================
+// Copyright (c) 2006-2016, Knut Reinert, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Knut Reinert or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL KNUT REINERT OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Your Name <your.email@example.net>
+// ==========================================================================
+
+
+// Seed search with (w,k)-minimizer tables over the genome. The seed patterns
+// of a stem loop are enumerated explicitly, the minimizer of the first window
+// of every pattern is looked up in the table with the largest window that
+// fits the pattern and the candidate loci are verified directly in the packed
+// text. The tables have windows from the whole seed length down to single
+// k-mers, so patterns shortened by skipped gap columns or short stem loops
+// are still served. Stem loops with too many seed patterns or patterns
+// shorter than k fall back to the online scanner.
+
+#ifndef APPS_RNAMOTIF_MINIMIZER_SEARCH_H_
+#define APPS_RNAMOTIF_MINIMIZER_SEARCH_H_
+
+#include "motif_structures.h"
+#include "online_search.h"
+
+// C++ headers
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+// ============================================================================
+// Forwards
+// ============================================================================
+
+// ============================================================================
+// Tags, Classes, Enums
+// ============================================================================
+
+// upper bound of explicitly enumerated seed patterns per stem loop
+const unsigned MaxMinimizerPatterns = 1 << 16;
+
+/*!
+ * @class MinimizerTable
+ *
+ * @brief Table of the (w,k)-minimizers of a set of sequences.
+ *
+ *	Every window of w consecutive k-mers without an N contributes its
+ *	smallest k-mer (leftmost on ties). The loci of a k-mer are stored
+ *	consecutively in loci, table maps the k-mer code to its range.
+ */
+
+struct MinimizerTable{
+	unsigned w = 1;
+
+	std::unordered_map<uint64_t, std::pair<unsigned, unsigned> > table;
+	std::vector<std::pair<unsigned, unsigned> > loci;
+};
+
+/*!
+ * @class MinimizerIndex
+ *
+ * @brief Minimizer tables of the packed text for several window sizes.
+ *
+ *	The windows are halved from table to table down to w = 1, a pattern
+ *	is looked up in the first table whose window span it covers. The
+ *	searches falling back to the online scanner are counted.
+ */
+
+struct MinimizerIndex{
+	PackedText text;
+	unsigned k = 12;
+
+	// decreasing window sizes, the last one has w = 1
+	std::vector<MinimizerTable> tables;
+
+	std::atomic<unsigned> searches{0};
+	std::atomic<unsigned> fallbacks{0};
+
+	// length of the text window a minimizer of table is selected from
+	unsigned span(MinimizerTable const &table) const {
+		return k + table.w - 1;
+	}
+};
+
+// ============================================================================
+// Metafunctions
+// ============================================================================
+
+// ============================================================================
+// Functions
+// ============================================================================
+
+// invertible mix of a k-mer code, orders the k-mers pseudo-randomly instead of
+// lexicographically (which would favour poly-A k-mers)
+inline uint64_t kmerHash(uint64_t x){
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+
+	return x;
+}
+
+void buildMinimizerTable(MinimizerTable &minimizers, PackedText const &text, unsigned k, unsigned w){
+	struct WindowKmer{
+		uint64_t hash;
+		uint64_t code;
+		unsigned start;
+	};
+
+	minimizers.w = w;
+	minimizers.table.clear();
+	minimizers.loci.clear();
+
+	uint64_t mask = (k < 32) ? (((uint64_t)1 << (2*k)) - 1) : ~(uint64_t)0;
+
+	// (k-mer, (contig, position))
+	std::vector<std::pair<uint64_t, std::pair<unsigned, unsigned> > > entries;
+
+	for (unsigned contig=0; contig < text.size(); ++contig){
+		std::deque<WindowKmer> window;
+		uint64_t code = 0;
+		unsigned valid = 0;
+		long last = -1;
+
+		for (unsigned pos=0; pos < text.lengths[contig]; ++pos){
+			unsigned c = text.code(contig, pos);
+
+			// k-mers never span an N
+			if (c == UnknownBase){
+				valid = 0;
+				window.clear();
+				continue;
+			}
+
+			code = ((code << 2) | c) & mask;
+
+			if (++valid < k)
+				continue;
+
+			WindowKmer kmer = {kmerHash(code), code, pos-k+1};
+
+			// keep the candidates increasing, the older one wins on ties
+			while (!window.empty() && window.back().hash > kmer.hash)
+				window.pop_back();
+			window.push_back(kmer);
+
+			while (window.front().start + w <= kmer.start)
+				window.pop_front();
+
+			// the window is not complete yet
+			if (valid < k+w-1)
+				continue;
+
+			if ((long)window.front().start != last){
+				last = window.front().start;
+				entries.push_back(std::make_pair(window.front().code, std::make_pair(contig, window.front().start)));
+			}
+		}
+	}
+
+	std::sort(entries.begin(), entries.end());
+
+	minimizers.loci.reserve(entries.size());
+
+	for (unsigned i=0; i < entries.size(); ++i){
+		if (i == 0 || entries[i].first != entries[i-1].first)
+			minimizers.table[entries[i].first].first = i;
+
+		minimizers.table[entries[i].first].second = i+1;
+		minimizers.loci.push_back(entries[i].second);
+	}
+}
+
+// pack the text and build the tables for the windows w, w/2, ..., 1
+template <typename TStringSet>
+void buildMinimizerIndex(MinimizerIndex &index, TStringSet const &seqs, unsigned k, unsigned w){
+	index.k = k;
+	index.tables.clear();
+
+	packText(index.text, seqs);
+
+	for (w = std::max(1u, w); ; w /= 2){
+		index.tables.push_back(MinimizerTable());
+		buildMinimizerTable(index.tables.back(), index.text, k, w);
+
+		if (w == 1)
+			break;
+	}
+}
+
+// table with the largest window that a pattern of length len covers, NULL if
+// the pattern is shorter than a k-mer
+MinimizerTable const * minimizerTable(MinimizerIndex const &index, unsigned len){
+	for (MinimizerTable const &table : index.tables){
+		if (index.span(table) <= len)
+			return &table;
+	}
+
+	return NULL;
+}
+
+void printMinimizerStats(MinimizerIndex const &index){
+	std::cout << "Minimizer searches: " << index.searches << ", online fallbacks: " << index.fallbacks << "\n";
+}
+
+std::vector<unsigned> sequenceLengths(MinimizerIndex const &index){
+	return index.text.lengths;
+}
+
+// Offset of the minimizer of the first window of a pattern (in text order),
+// chosen with the same rule as in buildMinimizerIndex().
+unsigned patternMinimizer(std::vector<uint8_t> const &pattern, unsigned k, unsigned w, uint64_t &kmer){
+	uint64_t mask = (k < 32) ? (((uint64_t)1 << (2*k)) - 1) : ~(uint64_t)0;
+	uint64_t code = 0, best_hash = 0;
+	unsigned offset = 0;
+
+	for (unsigned i=0; i < k+w-1; ++i){
+		code = ((code << 2) | pattern[i]) & mask;
+
+		if (i+1 < k)
+			continue;
+
+		uint64_t hash = kmerHash(code);
+
+		if (i+1 == k || hash < best_hash){
+			best_hash = hash;
+			kmer = code;
+			offset = i+1-k;
+		}
+	}
+
+	return offset;
+}
+
+// Enumerate the concrete seed patterns of the steps [step, last). left holds
+// the characters left of the hairpin from the inside out, right the ones on
+// the right side. Returns false if more than MaxMinimizerPatterns are generated.
+template <typename TReport>
+bool enumerateSeeds(StemLoopModel const &model, unsigned step, unsigned last, std::vector<uint8_t> &left, std::vector<uint8_t> &right, unsigned &count, TReport &report){
+	if (step == last){
+		if (++count > MaxMinimizerPatterns)
+			return false;
+
+		report(left, right);
+		return true;
+	}
+
+	StemLoopStep const &s = model.steps[step];
+	bool ok = true;
+
+	if (s.optional && !enumerateSeeds(model, step+1, last, left, right, count, report))
+		return false;
+
+	if (s.paired){
+		for (unsigned c=0; c < 16 && ok; ++c){
+			if (!((s.pairs >> c) & 1))
+				continue;
+
+			left.push_back(c >> 2);
+			right.push_back(c & 3);
+			ok = enumerateSeeds(model, step+1, last, left, right, count, report);
+			left.pop_back();
+			right.pop_back();
+		}
+	}
+	else{
+		std::vector<uint8_t> &side = s.left ? left : right;
+		uint8_t mask = s.left ? s.lmask : s.rmask;
+
+		for (unsigned c=0; c < UnknownBase && ok; ++c){
+			if (!((mask >> c) & 1))
+				continue;
+
+			side.push_back(c);
+			ok = enumerateSeeds(model, step+1, last, left, right, count, report);
+			side.pop_back();
+		}
+	}
+
+	return ok;
+}
+
+// Search the seed of a stem loop (the same steps as the online scanner uses)
+// via the minimizer tables and report delegate(contig, start, stem_id).
+template <typename TDelegate>
+unsigned searchStemLoop(MinimizerIndex &index, TStructure &structure, unsigned stem_id, int seed_len, double freq_threshold, TDelegate &&delegate){
+	StemLoopModel model = compileStemLoop(structure, freq_threshold);
+
+	int struclen = structure.pos.second - structure.pos.first + 1;
+	unsigned minSeed = std::min(struclen, seed_len);
+	unsigned n_steps = seedSteps(model, minSeed);
+
+	if (n_steps == 0)
+		return 0;
+
+	++index.searches;
+
+	std::vector<std::vector<uint8_t> > patterns;
+	std::vector<uint8_t> left, right;
+	unsigned count = 0;
+	bool short_pattern = false;
+
+	auto collect = [&](std::vector<uint8_t> const &l, std::vector<uint8_t> const &r){
+		std::vector<uint8_t> pattern(l.rbegin(), l.rend());
+		pattern.insert(pattern.end(), r.begin(), r.end());
+
+		short_pattern |= pattern.size() < index.k;
+		patterns.push_back(pattern);
+	};
+
+	// a pattern shorter than a k-mer is in none of the tables
+	if (!enumerateSeeds(model, 0, n_steps, left, right, count, collect) || short_pattern){
+		++index.fallbacks;
+		return searchStemLoop(index.text, structure, stem_id, seed_len, freq_threshold, delegate);
+	}
+
+	std::set<std::pair<unsigned, long> > reported;
+	unsigned occ_sum = 0;
+
+	for (std::vector<uint8_t> const &pattern : patterns){
+		MinimizerTable const &table = *minimizerTable(index, pattern.size());
+
+		uint64_t kmer;
+		unsigned offset = patternMinimizer(pattern, index.k, table.w, kmer);
+
+		auto range = table.table.find(kmer);
+
+		if (range == table.table.end())
+			continue;
+
+		for (unsigned j=range->second.first; j < range->second.second; ++j){
+			unsigned contig = table.loci[j].first;
+			long start = (long)table.loci[j].second - offset;
+
+			if (start < 0 || start + (long)pattern.size() > (long)index.text.lengths[contig])
+				continue;
+
+			bool match = true;
+			for (unsigned t=0; t < pattern.size() && match; ++t){
+				match = index.text.code(contig, start+t) == pattern[t];
+			}
+
+			if (match && reported.insert(std::make_pair(contig, start)).second){
+				delegate(contig, start, stem_id);
+				++occ_sum;
+			}
+		}
+	}
+
+	return occ_sum;
+}
+
+#endif  // #ifndef APPS_RNAMOTIF_MINIMIZER_SEARCH_H_
@@ -170,7 +170,242 @@ void bracketToInteractions(const char* structure, TConsensusStructure& interacti
 	}
 }
 
-TLoopProfileString addProfile(StructureElement &structureElement, unsigned start, unsigned end, TAlign &align, std::set<int> &excludeSet, bool reverse = false){
+// Weights of the alignment rows for the profiles. Identical rows are collapsed
+// into the first of them, which carries the number of identical rows as
+// weight, the others get weight 0. The profiles are the same as counting every
+// row, but each distinct row is only processed once.
+std::vector<unsigned> collapsedRowWeights(TAlign &align){
+	unsigned n_rows = length(rows(align));
+	std::vector<unsigned> weights(n_rows, 1);
+	std::unordered_map<std::string, unsigned> first_row;
+
+	for (unsigned row=0; row < n_rows; ++row){
+		TRow & i_row = seqan::row(align,row);
+		unsigned n = seqan::length(i_row);
+
+		std::string key(n, '-');
+		for (unsigned i=0; i < n; ++i){
+			if (!seqan::isGap(i_row, i))
+				key[i] = seqan::convert<char>(i_row[i]);
+		}
+
+		auto it = first_row.find(key);
+		if (it == first_row.end()){
+			first_row[key] = row;
+		}
+		else{
+			weights[it->second] += 1;
+			weights[row] = 0;
+		}
+	}
+
+	return weights;
+}
+
+inline bool isAlignmentGap(char c){
+	return c == '-' || c == '.';
+}
+
+// identity of two aligned rows over the columns not gapped in both
+double rowIdentity(std::string const &a, std::string const &b){
+	unsigned same = 0, columns = 0;
+
+	for (size_t i=0; i < a.size() && i < b.size(); ++i){
+		if (isAlignmentGap(a[i]) && isAlignmentGap(b[i]))
+			continue;
+
+		++columns;
+		same += (a[i] == b[i]);
+	}
+
+	return columns == 0 ? 1 : (double)same / columns;
+}
+
+// Rows to fold. Identical rows are folded once with the number of identical
+// rows as weight. With max_rows > 0, at most max_rows of the distinct rows are
+// kept: starting with the heaviest row, the row least identical to all rows
+// picked so far is added (greedy max-min identity). Every dropped row adds
+// its weight to the most identical picked row.
+std::vector<std::string> foldingRows(std::vector<std::string> const &rows, unsigned max_rows, std::vector<double> &weights){
+	std::vector<std::string> distinct;
+	std::unordered_map<std::string, unsigned> index;
+
+	weights.clear();
+	for (std::string const &row : rows){
+		auto it = index.find(row);
+		if (it == index.end()){
+			index[row] = distinct.size();
+			distinct.push_back(row);
+			weights.push_back(1);
+		}
+		else{
+			weights[it->second] += 1;
+		}
+	}
+
+	if (max_rows == 0 || distinct.size() <= max_rows)
+		return distinct;
+
+	size_t n = distinct.size();
+	std::vector<bool> picked(n, false);
+	std::vector<double> max_identity(n, -1);
+	// picked row with the highest identity to each row
+	std::vector<size_t> nearest(n, 0);
+	std::vector<size_t> order;
+
+	size_t next = std::max_element(weights.begin(), weights.end()) - weights.begin();
+
+	while (order.size() < max_rows){
+		picked[next] = true;
+		order.push_back(next);
+
+		size_t farthest = n;
+		for (size_t r=0; r < n; ++r){
+			if (picked[r])
+				continue;
+
+			double identity = rowIdentity(distinct[r], distinct[next]);
+			if (identity > max_identity[r]){
+				max_identity[r] = identity;
+				nearest[r] = next;
+			}
+
+			if (farthest == n || max_identity[r] < max_identity[farthest] ||
+				(max_identity[r] == max_identity[farthest] && weights[r] > weights[farthest]))
+				farthest = r;
+		}
+
+		next = farthest;
+	}
+
+	std::vector<double> picked_weights(n, 0);
+	for (size_t r=0; r < n; ++r)
+		picked_weights[picked[r] ? r : nearest[r]] += weights[r];
+
+	std::vector<std::string> subsample;
+	std::vector<double> subsample_weights;
+	for (size_t r : order){
+		subsample.push_back(distinct[r]);
+		subsample_weights.push_back(picked_weights[r]);
+	}
+
+	weights = subsample_weights;
+	return subsample;
+}
+
+// Columns of the aligned rows kept for folding: columns with a weighted gap
+// fraction above max_gap_fraction are dropped. The original indices of the
+// kept columns are returned to map the folded structure back.
+std::vector<int> foldingColumns(std::vector<std::string> const &rows, std::vector<double> const &weights, double max_gap_fraction){
+	std::vector<int> columns;
+	if (rows.empty())
+		return columns;
+
+	size_t length = rows[0].size();
+	double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+
+	for (size_t i=0; i < length; ++i){
+		double gaps = 0;
+		for (size_t r=0; r < rows.size(); ++r){
+			if (isAlignmentGap(rows[r][i]))
+				gaps += weights[r];
+		}
+
+		if (gaps <= max_gap_fraction * total)
+			columns.push_back(i);
+	}
+
+	// nothing left to fold, keep the alignment as it is
+	if (columns.empty()){
+		columns.resize(length);
+		std::iota(columns.begin(), columns.end(), 0);
+	}
+
+	return columns;
+}
+
+void trimColumns(std::vector<std::string> &rows, std::vector<int> const &columns){
+	for (std::string &row : rows){
+		std::string trimmed(columns.size(), '-');
+		for (size_t k=0; k < columns.size(); ++k)
+			trimmed[k] = row[columns[k]];
+		row.swap(trimmed);
+	}
+}
+
+// Dot bracket structure (e.g. a constraint) of the original columns in the
+// trimmed columns. A bracket whose partner column was dropped becomes
+// unpaired, so the brackets stay balanced.
+std::string projectStructure(std::string const &structure, std::vector<int> const &columns){
+	std::vector<int> partner(structure.size(), -1);
+	std::stack<int> open;
+
+	for (int i=0; i < (int)structure.size(); ++i){
+		if (structure[i] == '(')
+			open.push(i);
+		else if (structure[i] == ')' && !open.empty()){
+			partner[i] = open.top();
+			partner[open.top()] = i;
+			open.pop();
+		}
+	}
+
+	std::vector<bool> kept(structure.size(), false);
+	for (int column : columns)
+		kept[column] = true;
+
+	std::string projected(columns.size(), '.');
+	for (size_t k=0; k < columns.size(); ++k){
+		char c = structure[columns[k]];
+		bool bracket = (c == '(' || c == ')');
+
+		if (!bracket || (partner[columns[k]] != -1 && kept[partner[columns[k]]]))
+			projected[k] = c;
+	}
+
+	return projected;
+}
+
+// dot bracket structure of the trimmed columns in the original columns,
+// dropped columns are unpaired
+std::string expandStructure(std::string const &structure, std::vector<int> const &columns, size_t length){
+	std::string expanded(length, '.');
+	for (size_t k=0; k < columns.size(); ++k)
+		expanded[columns[k]] = structure[k];
+
+	return expanded;
+}
+
+TConsensusStructure expandConsensusStructure(TConsensusStructure const &consensus, std::vector<int> const &columns, size_t length){
+	TConsensusStructure expanded(length, std::make_pair(MAX, -1));
+	for (size_t k=0; k < consensus.size(); ++k){
+		int partner = consensus[k].second;
+		expanded[columns[k]] = std::make_pair(consensus[k].first, partner == -1 ? -1 : columns[partner]);
+	}
+
+	return expanded;
+}
+
+// map the position and interactions of a stem loop found in the trimmed
+// columns back to the original columns
+void expandStemLoop(TStructure &stemLoop, std::vector<int> const &columns, size_t length){
+	TInteractions expanded(length, -1);
+	for (size_t k=0; k < stemLoop.interactions.size(); ++k){
+		int partner = stemLoop.interactions[k];
+		if (partner != -1)
+			expanded[columns[k]] = columns[partner];
+	}
+
+	stemLoop.interactions.swap(expanded);
+	stemLoop.pos = std::make_pair(columns[stemLoop.pos.first], columns[stemLoop.pos.second]);
+}
+
+// an empty weight vector weights all rows equally
+inline unsigned rowWeight(std::vector<unsigned> const &weights, unsigned row){
+	return weights.empty() ? 1 : weights[row];
+}
+
+TLoopProfileString addProfile(StructureElement &structureElement, unsigned start, unsigned end, TAlign &align, std::vector<unsigned> const &weights, std::set<int> &excludeSet, bool reverse = false){
 	typedef seqan::Row<TAlign>::Type TRow;
 	typedef typename seqan::Value<TLoopProfileString>::Type TProfileChar;
 
@@ -191,7 +426,9 @@ TLoopProfileString addProfile(StructureElement &structureElement, unsigned start
 		//if (row != 45)
 		//	continue;
 
-		if (excludeSet.find(row) != excludeSet.end()){
+		unsigned weight = rowWeight(weights, row);
+
+		if (weight == 0 || excludeSet.find(row) != excludeSet.end()){
 			continue;
 		}
 
@@ -219,7 +456,7 @@ TLoopProfileString addProfile(StructureElement &structureElement, unsigned start
 		//	continue;
 
 		// set the statistics (min, max, average lengths)
-		stats.mean_length += seqLength;
+		stats.mean_length += weight * seqLength;
 
 		if (seqLength < stats.min_length){
 			stats.min_length = seqLength;
@@ -247,7 +484,7 @@ TLoopProfileString addProfile(StructureElement &structureElement, unsigned start
 			}
 			else if (gap_run > 0){
 				//std::cout << "Run: " << run_start << " " << gap_run << "\n";
-				gapString[run_start][gap_run]++;
+				gapString[run_start][gap_run] += weight;
 				gap_run = 0;
 				run_start = -1;
 			}
@@ -263,21 +500,25 @@ TLoopProfileString addProfile(StructureElement &structureElement, unsigned start
 			}
 
 			if (reverse)
-				profileString[n-i-1].count[ord_val] += 1;
+				profileString[n-i-1].count[ord_val] += weight;
 			else
-				profileString[i].count[ord_val] += 1;
+				profileString[i].count[ord_val] += weight;
 		}
 
 		if (gap_run > 0){
 			//std::cout << "Run: " << run_start << " " << gap_run << "\n";
-			gapString[run_start][gap_run]++;
+			gapString[run_start][gap_run] += weight;
 		}
 		//std::cout << std::endl;
 	}
 
 	//std::cout << "\n";
 
-	stats.mean_length = stats.mean_length / length(rows(align));
+	unsigned n_rows = 0;
+	for (unsigned row=0; row < length(rows(align)); ++row)
+		n_rows += rowWeight(weights, row);
+
+	stats.mean_length = stats.mean_length / n_rows;
 
 	if (structureElement.type == StructureType::HAIRPIN && stats.min_length < 3)
 		stats.min_length = 3;
@@ -289,7 +530,7 @@ TLoopProfileString addProfile(StructureElement &structureElement, unsigned start
 	return profileString;
 }
 
-TStemProfileString addProfile(StructureElement &structureElement, unsigned start1, unsigned end1, unsigned start2, unsigned end2, TAlign &align, std::set<int> &excludeSet){
+TStemProfileString addProfile(StructureElement &structureElement, unsigned start1, unsigned end1, unsigned start2, unsigned end2, TAlign &align, std::vector<unsigned> const &weights, std::set<int> &excludeSet){
 
 	if (end1-start1+1 != end2-start2+1){
 		throw(std::runtime_error("Stem is not properly sized."));
@@ -308,8 +549,10 @@ TStemProfileString addProfile(StructureElement &structureElement, unsigned start
 		//if (row != 45)
 		//	continue;
 
+		unsigned weight = rowWeight(weights, row);
+
 		// skip row if we excluded it because of gaps that are too large
-		if (excludeSet.find(row) != excludeSet.end()){
+		if (weight == 0 || excludeSet.find(row) != excludeSet.end()){
 			continue;
 		}
 
@@ -331,7 +574,7 @@ TStemProfileString addProfile(StructureElement &structureElement, unsigned start
 				run_start = run_start == -1 ? i : run_start;
 			}
 			else if (gap_run > 0){
-				gapString[run_start][gap_run]++;
+				gapString[run_start][gap_run] += weight;
 				gap_run = 0;
 				run_start = -1;
 			}
@@ -353,7 +596,7 @@ TStemProfileString addProfile(StructureElement &structureElement, unsigned start
 
 				//assert(false);
 
-				profileString[n-i-1].count[pair_val] += 1;
+				profileString[n-i-1].count[pair_val] += weight;
 			}
 			/*
 			// if both characters are gaps
@@ -369,7 +612,7 @@ TStemProfileString addProfile(StructureElement &structureElement, unsigned start
 		}
 
 		if (gap_run > 0){
-			gapString[run_start][gap_run]++;
+			gapString[run_start][gap_run] += weight;
 		}
 	}
 
@@ -379,7 +622,7 @@ TStemProfileString addProfile(StructureElement &structureElement, unsigned start
 	return profileString;
 }
 
-std::vector<TLoopProfileString> getExternal(TConsensusStructure &consensus, TAlign &align){
+std::vector<TLoopProfileString> getExternal(TConsensusStructure &consensus, TAlign &align, std::vector<unsigned> const &weights){
 	TLoopProfileString profile;
 	typedef typename seqan::Value<TLoopProfileString>::Type TProfileChar;
 	int aln_len = seqan::length(seqan::row(align,0));
@@ -401,7 +644,7 @@ std::vector<TLoopProfileString> getExternal(TConsensusStructure &consensus, TAli
 				if (ord_val > seqan::ValueSize<TProfileChar>::VALUE)
 					ord_val = AlphabetSize-1;
 
-				profChar.count[ord_val] += 1;
+				profChar.count[ord_val] += rowWeight(weights, row);
 			}
 
 			seqan::appendValue(profile, profChar);
@@ -498,7 +741,7 @@ TStemLoopProfile findStemLoops(TConsensusStructure const &consensus){
 // * any unpaired bases in between are interior loops
 // 		* if no corresponding unpaired bases: bulge
 // * innermost unpaired bases are the hairpin
-void partitionStemLoop(TAlign &seedAlignment, TStructure &stemStructure){
+void partitionStemLoop(TAlign &seedAlignment, std::vector<unsigned> const &seedWeights, TStructure &stemStructure){
 	TInteractions &consensus = stemStructure.interactions;
 	//TInteractionPairs consensus(motif.consensusStructure);
 
@@ -506,7 +749,7 @@ void partitionStemLoop(TAlign &seedAlignment, TStructure &stemStructure){
 		std::set<int> tmpSet;
 		StructureElement tmp;
 		tmp.type == HAIRPIN;
-		addProfile(tmp, stemStructure.pos.first, stemStructure.pos.second, seedAlignment, tmpSet);
+		addProfile(tmp, stemStructure.pos.first, stemStructure.pos.second, seedAlignment, seedWeights, tmpSet);
 		std::cout << "VARIATION: " << tmp.statistics.min_length << " Max: " << tmp.statistics.max_length << "\n";
 	}
 
@@ -531,9 +774,9 @@ void partitionStemLoop(TAlign &seedAlignment, TStructure &stemStructure){
 
 					stem.type = STEM;
 					stem.location = i;
-					TLoopProfileString leftProfile  = addProfile(stem, i, pos-1, seedAlignment, excludeSet, true);
-					TLoopProfileString rightProfile = addProfile(stem, consensus[pos-1], consensus[i], seedAlignment, excludeSet);
-					TStemProfileString stemProfile  = addProfile(stem, i, pos-1, consensus[pos-1], consensus[i], seedAlignment, excludeSet);
+					TLoopProfileString leftProfile  = addProfile(stem, i, pos-1, seedAlignment, seedWeights, excludeSet, true);
+					TLoopProfileString rightProfile = addProfile(stem, consensus[pos-1], consensus[i], seedAlignment, seedWeights, excludeSet);
+					TStemProfileString stemProfile  = addProfile(stem, i, pos-1, consensus[pos-1], consensus[i], seedAlignment, seedWeights, excludeSet);
 
 					stemStructure.elements.push_back(stem);
 
@@ -548,7 +791,7 @@ void partitionStemLoop(TAlign &seedAlignment, TStructure &stemStructure){
 
 					bulge.type = RBULGE;
 					bulge.location = unpaired+1;
-					TLoopProfileString bulgeProfile = addProfile(bulge, unpaired+1, right-1, seedAlignment, excludeSet);
+					TLoopProfileString bulgeProfile = addProfile(bulge, unpaired+1, right-1, seedAlignment, seedWeights, excludeSet);
 					bulge.loopLeft = false;
 					stemStructure.elements.push_back(bulge);
 
@@ -568,9 +811,9 @@ void partitionStemLoop(TAlign &seedAlignment, TStructure &stemStructure){
 
 			stem.type = STEM;
 			stem.location = i;
-			TLoopProfileString leftProfile  = addProfile(stem, i, pos-1, seedAlignment, excludeSet, true);
-			TLoopProfileString rightProfile = addProfile(stem, consensus[pos-1], consensus[i], seedAlignment, excludeSet);
-			TStemProfileString stemProfile  = addProfile(stem, i, pos-1, consensus[pos-1], consensus[i], seedAlignment, excludeSet);
+			TLoopProfileString leftProfile  = addProfile(stem, i, pos-1, seedAlignment, seedWeights, excludeSet, true);
+			TLoopProfileString rightProfile = addProfile(stem, consensus[pos-1], consensus[i], seedAlignment, seedWeights, excludeSet);
+			TStemProfileString stemProfile  = addProfile(stem, i, pos-1, consensus[pos-1], consensus[i], seedAlignment, seedWeights, excludeSet);
 
 			stemStructure.elements.push_back(stem);
 		}
@@ -593,7 +836,7 @@ void partitionStemLoop(TAlign &seedAlignment, TStructure &stemStructure){
 				DEBUG_MSG("Left bulge in [" << pos << "," << run-1 << " " << run-pos << "]");
 
 				structure.type = LBULGE;
-				TLoopProfileString bulgeProfile = addProfile(structure, pos, run-1, seedAlignment, excludeSet, true);
+				TLoopProfileString bulgeProfile = addProfile(structure, pos, run-1, seedAlignment, seedWeights, excludeSet, true);
 				structure.loopLeft = true;
 			}
 			// Hairpin (stop the outer loop here since all structures found)
@@ -601,7 +844,7 @@ void partitionStemLoop(TAlign &seedAlignment, TStructure &stemStructure){
 				DEBUG_MSG("Hairpin in [" << pos << "," << run-1 << " " << run-pos << "]");
 
 				structure.type = HAIRPIN;
-				TLoopProfileString hairpinProfile = addProfile(structure, pos, run-1, seedAlignment, excludeSet);
+				TLoopProfileString hairpinProfile = addProfile(structure, pos, run-1, seedAlignment, seedWeights, excludeSet);
 				std::cout << "HAIRPIN: " << structure.statistics.min_length << " Max: " << structure.statistics.max_length << "\n";
 				structure.loopLeft = false;
 			}
@@ -610,19 +853,19 @@ void partitionStemLoop(TAlign &seedAlignment, TStructure &stemStructure){
 				DEBUG_MSG("Left loop: [" << pos << "," << run-1 << "]" << " " << run-pos << " ; " << "Right loop: [" << lb+1 << "," << rb-1 << " " << rb-1-lb << "]");
 
 				structure.type = LOOP;
-				TLoopProfileString leftProfile  = addProfile(structure, pos, run-1, seedAlignment, excludeSet, true);
-				//TStemProfileString loopProfile  = addProfile(structure, pos, run-1, lb+1, rb-1, seedAlignment, excludeSet);
+				TLoopProfileString leftProfile  = addProfile(structure, pos, run-1, seedAlignment, seedWeights, excludeSet, true);
+				//TStemProfileString loopProfile  = addProfile(structure, pos, run-1, lb+1, rb-1, seedAlignment, seedWeights, excludeSet);
 				structure.loopLeft = true;
-				TLoopProfileString rightProfile = addProfile(structure2, lb+1, rb-1, seedAlignment, excludeSet);
-				//TStemProfileString loopProfile2 = addProfile(structure2, pos, run-1, lb+1, rb-1, seedAlignment, excludeSet);
+				TLoopProfileString rightProfile = addProfile(structure2, lb+1, rb-1, seedAlignment, seedWeights, excludeSet);
+				//TStemProfileString loopProfile2 = addProfile(structure2, pos, run-1, lb+1, rb-1, seedAlignment, seedWeights, excludeSet);
 				structure2.type = LOOP;
 				structure2.loopLeft = false;
 				structure2.location = lb+1;
 				struc2_set = true;
 
-				//TLoopProfileString leftProfile  = addProfile(structure, pos, run-1, seedAlignment, true);
-				//TLoopProfileString rightProfile = addProfile(structure, lb+1, rb-1, seedAlignment);
-				//TStemProfileString loopProfile  = addProfile(structure, pos, run-1, lb+1, rb-1, seedAlignment);
+				//TLoopProfileString leftProfile  = addProfile(structure, pos, run-1, seedAlignment, seedWeights, true);
+				//TLoopProfileString rightProfile = addProfile(structure, lb+1, rb-1, seedAlignment, seedWeights);
+				//TStemProfileString loopProfile  = addProfile(structure, pos, run-1, lb+1, rb-1, seedAlignment, seedWeights);
 			}
 
 			structure.location = pos;
@@ -37,6 +37,14 @@
 
 #include "motif_structures.h"
 #include "motif.h"
+#include "search_cache.h"
+#include "online_search.h"
+#include "minimizer_search.h"
+#include "seed_ngram.h"
+#include "benchmark_report.h"
+
+// C++ headers
+#include <mutex>
 
 // ============================================================================
 // Forwards
@@ -978,6 +986,20 @@ public:
 	unsigned countOccurrences(){
 		return seqan::countOccurrences(it);
 	}
+
+	// hand every occurrence of the current pattern to the delegate.
+	// The occurrences are a view on the suffix array, so nothing is copied.
+	template <typename TDelegate>
+	unsigned forEachOccurrence(TDelegate &&delegate){
+		auto occs = seqan::getOccurrences(it);
+		unsigned n = seqan::length(occs);
+
+		for (unsigned j=0; j < n; ++j){
+			delegate(seqan::value(occs, j));
+		}
+
+		return n;
+	}
 };
 
 // ============================================================================
@@ -1015,6 +1037,342 @@ void searchProfile(seqan::StringSet<seqan::String<TBaseAlphabet> > seqs, TStruct
 	std::cout << iter.count << " counted \n";
 }
 
+// Search all patterns of a stem loop and call delegate(contig, position, stem_id)
+// for every occurrence. Returns the number of occurrences seen.
+template <typename TBidirectionalIndex, typename TDelegate>
+unsigned searchStemLoop(TBidirectionalIndex &index, TStructure &structure, unsigned stem_id, int seed_len, double freq_threshold, TDelegate &&delegate){
+	typedef typename seqan::SAValue<TBidirectionalIndex>::Type THitPair;
+
+	int struclen = structure.pos.second - structure.pos.first + 1;
+	int minSeed = std::min(struclen, seed_len);
+
+	MotifIterator<TBidirectionalIndex> iter(structure, index, minSeed, freq_threshold);
+
+	unsigned occ_sum = 0;
+
+	while (iter.next()){
+		occ_sum += iter.forEachOccurrence([&](THitPair const &pos){
+			delegate(pos.i1, pos.i2, stem_id);
+		});
+	}
+
+	return occ_sum;
+}
+
+// Same as above, but serve the hits from the on-disk cache if possible.
+// Misses are searched in the index and stored in the cache afterwards.
+template <typename TBidirectionalIndex, typename TDelegate>
+unsigned searchStemLoop(TBidirectionalIndex &index, TStructure &structure, unsigned stem_id, int seed_len, double freq_threshold, SearchCache const &cache, TDelegate &&delegate){
+	if (!cache.enabled()){
+		return searchStemLoop(index, structure, stem_id, seed_len, freq_threshold, delegate);
+	}
+
+	uint64_t key = searchCacheKey(cache, structure, seed_len, freq_threshold);
+	std::string path = cache.path(key);
+
+	TCachedHits hits;
+
+	if (readCachedHits(hits, path, key)){
+		for (auto const &hit : hits){
+			delegate(hit.first, hit.second, stem_id);
+		}
+
+		return hits.size();
+	}
+
+	unsigned occ_sum = searchStemLoop(index, structure, stem_id, seed_len, freq_threshold,
+		[&](unsigned contig, unsigned pos, unsigned stem){
+			hits.push_back(std::make_pair(contig, pos));
+			delegate(contig, pos, stem);
+		});
+
+	if (!writeCachedHits(hits, path, key)){
+		std::cerr << "Could not write search cache file " << path << "\n";
+	}
+
+	return occ_sum;
+}
+
+// Search space that runs the compiled step model of a stem loop on the index.
+// Gapped columns are single optional steps (a bounded variable-length gap)
+// instead of one enumeration branch per observed gap length.
+template <typename TBidirectionalIndex>
+struct GapWildcardIndex{
+	TBidirectionalIndex &index;
+
+	GapWildcardIndex(TBidirectionalIndex &index) : index(index) {}
+};
+
+template <typename TBidirectionalIndex>
+std::vector<unsigned> sequenceLengths(GapWildcardIndex<TBidirectionalIndex> &gapped){
+	return sequenceLengths(gapped.index);
+}
+
+// Depth-first search of the steps [step, last) in the index. Paths that skip
+// different optional steps but arrive at the same step with the same SA
+// interval continue identically, so every (step, interval) is expanded once.
+template <typename TIterator, typename TReport>
+void searchGappedSteps(StemLoopModel const &model, TIterator const &it, unsigned step, unsigned last,
+					   std::set<std::tuple<unsigned, unsigned, unsigned, unsigned> > &visited, TReport &report){
+	auto const &range = seqan::value(it.fwdIter).range;
+
+	if (!visited.insert(std::make_tuple(step, (unsigned)range.i1, (unsigned)range.i2, (unsigned)seqan::repLength(it))).second)
+		return;
+
+	if (step == last){
+		if (seqan::repLength(it) > 0)
+			report(it);
+		return;
+	}
+
+	StemLoopStep const &s = model.steps[step];
+
+	if (s.optional)
+		searchGappedSteps(model, it, step+1, last, visited, report);
+
+	if (s.paired){
+		for (unsigned c=0; c < 16; ++c){
+			if (!((s.pairs >> c) & 1))
+				continue;
+
+			TIterator next = it;
+			if (seqan::goDown(next, c >> 2, seqan::Fwd()) && seqan::goDown(next, c & 3, seqan::Rev()))
+				searchGappedSteps(model, next, step+1, last, visited, report);
+		}
+	}
+	else{
+		uint8_t mask = s.left ? s.lmask : s.rmask;
+
+		for (unsigned c=0; c < UnknownBase; ++c){
+			if (!((mask >> c) & 1))
+				continue;
+
+			TIterator next = it;
+			bool extended = s.left ? seqan::goDown(next, c, seqan::Fwd()) : seqan::goDown(next, c, seqan::Rev());
+
+			if (extended)
+				searchGappedSteps(model, next, step+1, last, visited, report);
+		}
+	}
+}
+
+// Search the seed steps of a stem loop (as the online scanner does) in the index
+// and call delegate(contig, position, stem_id) once for every start position.
+template <typename TBidirectionalIndex, typename TDelegate>
+unsigned searchStemLoop(GapWildcardIndex<TBidirectionalIndex> &gapped, TStructure &structure, unsigned stem_id, int seed_len, double freq_threshold, TDelegate &&delegate){
+	typedef typename seqan::Iterator<TBidirectionalIndex, seqan::TopDown<> >::Type TIterator;
+	typedef typename seqan::SAValue<TBidirectionalIndex>::Type THitPair;
+
+	StemLoopModel model = compileStemLoop(structure, freq_threshold);
+
+	int struclen = structure.pos.second - structure.pos.first + 1;
+	unsigned minSeed = std::min(struclen, seed_len);
+	unsigned n_steps = seedSteps(model, minSeed, 64);
+
+	if (n_steps == 0)
+		return 0;
+
+	std::set<std::tuple<unsigned, unsigned, unsigned, unsigned> > visited;
+	std::set<std::pair<unsigned, unsigned> > reported;
+	unsigned occ_sum = 0;
+
+	auto report = [&](TIterator const &it){
+		auto occs = seqan::getOccurrences(it);
+
+		for (unsigned j=0; j < seqan::length(occs); ++j){
+			THitPair const &pos = seqan::value(occs, j);
+
+			if (reported.insert(std::make_pair((unsigned)pos.i1, (unsigned)pos.i2)).second){
+				delegate(pos.i1, pos.i2, stem_id);
+				++occ_sum;
+			}
+		}
+	};
+
+	TIterator it(gapped.index);
+	searchGappedSteps(model, it, 0, n_steps, visited, report);
+
+	return occ_sum;
+}
+
+// Search space that finds only the hairpin-proximal index_cols columns of a
+// seed in the index. The outer steps are determined by the anchor position and
+// are verified against the packed text, one bit test per base or base pair
+// instead of two rank queries per pair.
+template <typename TBidirectionalIndex>
+struct HalfIndex{
+	TBidirectionalIndex &index;
+	PackedText const &text;
+	unsigned index_cols;
+
+	HalfIndex(TBidirectionalIndex &index, PackedText const &text, unsigned index_cols) : index(index), text(text), index_cols(index_cols) {}
+};
+
+template <typename TBidirectionalIndex>
+std::vector<unsigned> sequenceLengths(HalfIndex<TBidirectionalIndex> &half){
+	return half.text.lengths;
+}
+
+template <typename TBidirectionalIndex, typename TDelegate>
+unsigned searchStemLoop(HalfIndex<TBidirectionalIndex> &half, TStructure &structure, unsigned stem_id, int seed_len, double freq_threshold, TDelegate &&delegate){
+	typedef typename seqan::Iterator<TBidirectionalIndex, seqan::TopDown<> >::Type TIterator;
+	typedef typename seqan::SAValue<TBidirectionalIndex>::Type THitPair;
+
+	StemLoopModel model = compileStemLoop(structure, freq_threshold);
+
+	int struclen = structure.pos.second - structure.pos.first + 1;
+	unsigned minSeed = std::min(struclen, seed_len);
+	unsigned n_steps = seedSteps(model, minSeed, 64);
+	unsigned anchor_steps = seedSteps(model, std::min(minSeed, half.index_cols), 64);
+
+	if (n_steps == 0 || anchor_steps == 0)
+		return 0;
+
+	std::set<std::tuple<unsigned, unsigned, unsigned, unsigned> > visited;
+	std::set<std::pair<unsigned, long> > reported;
+	unsigned occ_sum = 0;
+
+	auto report = [&](TIterator const &it){
+		auto occs = seqan::getOccurrences(it);
+		long anchor_len = seqan::repLength(it);
+
+		for (unsigned j=0; j < seqan::length(occs); ++j){
+			THitPair const &pos = seqan::value(occs, j);
+			unsigned contig = pos.i1;
+
+			// the anchor covers [i2, i2+anchor_len), extend it outwards in the text
+			auto verified = [&](long start, long end){
+				if (reported.insert(std::make_pair(contig, start)).second){
+					delegate(contig, start, stem_id);
+					++occ_sum;
+				}
+			};
+
+			verifySteps(model, half.text, contig, anchor_steps, n_steps, (long)pos.i2-1, (long)pos.i2+anchor_len, verified);
+		}
+	};
+
+	TIterator it(half.index);
+	searchGappedSteps(model, it, 0, anchor_steps, visited, report);
+
+	return occ_sum;
+}
+
+// Search space that only extends patterns with step symbols observed in the
+// seed rows (a k-th order model), allowing up to edits unobserved extensions.
+// The alignment is the one of the motif currently searched.
+template <typename TBidirectionalIndex>
+struct SeedNgramIndex{
+	TBidirectionalIndex &index;
+	TAlign &alignment;
+	unsigned order;
+	unsigned edits;
+
+	SeedNgramIndex(TBidirectionalIndex &index, TAlign &alignment, unsigned order, unsigned edits)
+		: index(index), alignment(alignment), order(order), edits(edits) {}
+};
+
+template <typename TBidirectionalIndex>
+std::vector<unsigned> sequenceLengths(SeedNgramIndex<TBidirectionalIndex> &seeded){
+	return sequenceLengths(seeded.index);
+}
+
+typedef std::tuple<unsigned, unsigned, unsigned, unsigned, uint64_t, unsigned> TNgramState;
+
+// Same as searchGappedSteps(), but every extension (or skipped optional step)
+// has to be backed by the n-gram model or uses up one of the remaining edits.
+template <typename TIterator, typename TReport>
+void searchNgramSteps(StemLoopModel const &model, SeedNgramModel const &ngrams, TIterator const &it, unsigned step, unsigned last,
+					  uint64_t context, unsigned edits, std::set<TNgramState> &visited, TReport &report){
+	auto const &range = seqan::value(it.fwdIter).range;
+
+	if (!visited.insert(TNgramState(step, range.i1, range.i2, seqan::repLength(it), context, edits)).second)
+		return;
+
+	if (step == last){
+		if (seqan::repLength(it) > 0)
+			report(it);
+		return;
+	}
+
+	StemLoopStep const &s = model.steps[step];
+
+	// continue with symbol if the model or the edit budget allows it
+	auto follow = [&](TIterator const &next, unsigned symbol){
+		if (ngrams.seen(step, context, symbol))
+			searchNgramSteps(model, ngrams, next, step+1, last, ngrams.extend(context, symbol), edits, visited, report);
+		else if (edits > 0)
+			searchNgramSteps(model, ngrams, next, step+1, last, ngrams.extend(context, symbol), edits-1, visited, report);
+	};
+
+	if (s.optional)
+		follow(it, SeedGapSymbol);
+
+	if (s.paired){
+		for (unsigned c=0; c < 16; ++c){
+			if (!((s.pairs >> c) & 1))
+				continue;
+
+			TIterator next = it;
+			if (seqan::goDown(next, c >> 2, seqan::Fwd()) && seqan::goDown(next, c & 3, seqan::Rev()))
+				follow(next, c);
+		}
+	}
+	else{
+		uint8_t mask = s.left ? s.lmask : s.rmask;
+
+		for (unsigned c=0; c < UnknownBase; ++c){
+			if (!((mask >> c) & 1))
+				continue;
+
+			TIterator next = it;
+			bool extended = s.left ? seqan::goDown(next, c, seqan::Fwd()) : seqan::goDown(next, c, seqan::Rev());
+
+			if (extended)
+				follow(next, c);
+		}
+	}
+}
+
+template <typename TBidirectionalIndex, typename TDelegate>
+unsigned searchStemLoop(SeedNgramIndex<TBidirectionalIndex> &seeded, TStructure &structure, unsigned stem_id, int seed_len, double freq_threshold, TDelegate &&delegate){
+	typedef typename seqan::Iterator<TBidirectionalIndex, seqan::TopDown<> >::Type TIterator;
+	typedef typename seqan::SAValue<TBidirectionalIndex>::Type THitPair;
+
+	StemLoopModel model = compileStemLoop(structure, freq_threshold);
+
+	int struclen = structure.pos.second - structure.pos.first + 1;
+	unsigned minSeed = std::min(struclen, seed_len);
+	unsigned n_steps = seedSteps(model, minSeed, 64);
+
+	if (n_steps == 0)
+		return 0;
+
+	SeedNgramModel ngrams = buildSeedNgramModel(seeded.alignment, model, n_steps, seeded.order);
+
+	std::set<TNgramState> visited;
+	std::set<std::pair<unsigned, unsigned> > reported;
+	unsigned occ_sum = 0;
+
+	auto report = [&](TIterator const &it){
+		auto occs = seqan::getOccurrences(it);
+
+		for (unsigned j=0; j < seqan::length(occs); ++j){
+			THitPair const &pos = seqan::value(occs, j);
+
+			if (reported.insert(std::make_pair((unsigned)pos.i1, (unsigned)pos.i2)).second){
+				delegate(pos.i1, pos.i2, stem_id);
+				++occ_sum;
+			}
+		}
+	};
+
+	TIterator it(seeded.index);
+	searchNgramSteps(model, ngrams, it, 0, n_steps, 0, seeded.edits, visited, report);
+
+	return occ_sum;
+}
+
 typedef std::vector<std::vector<std::vector<bool> > > TBoolVec;
 
 template <typename TBidirectionalIndex>
@@ -1153,120 +1511,209 @@ TBoolVec getStemloopPositions2(TBidirectionalIndex &index, Motif *motif, int see
 	return pos_hits;
 }
 
-template <typename TBidirectionalIndex>
+// Reference records of one family, sorted by start per contig. Together with the
+// running maximum of the ends, the records containing a position are found with
+// a binary search and a short backwards scan.
+struct ReferenceIntervals{
+	struct Contig{
+		std::vector<int> starts;
+		std::vector<int> ends;
+		std::vector<int> maxEnds;
+		std::vector<unsigned> records;
+	};
+
+	std::unordered_map<unsigned, Contig> contigs;
+};
+
+// Records are keyed by the contig they are matched against in countStemloopHits().
+ReferenceIntervals buildReferenceIntervals(std::vector<RfamBenchRecord> const &refrec){
+	ReferenceIntervals intervals;
+
+	std::vector<unsigned> order(refrec.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b){
+		return refrec[a].start < refrec[b].start;
+	});
+
+	for (unsigned r : order){
+		RfamBenchRecord const &rec = refrec[r];
+
+		if (rec.end < rec.start || rec.ref_nr < -1)
+			continue;
+
+		ReferenceIntervals::Contig &contig = intervals.contigs[rec.ref_nr+1];
+
+		contig.starts.push_back(rec.start);
+		contig.ends.push_back(rec.end);
+		contig.maxEnds.push_back(contig.maxEnds.empty() ? rec.end : std::max(contig.maxEnds.back(), rec.end));
+		contig.records.push_back(r);
+	}
+
+	return intervals;
+}
+
+// call report(record) for every record containing pos, returns their number
+template <typename TReport>
+unsigned findReferenceRecords(ReferenceIntervals const &intervals, unsigned contig_id, int pos, TReport &&report){
+	auto found = intervals.contigs.find(contig_id);
+
+	if (found == intervals.contigs.end())
+		return 0;
+
+	ReferenceIntervals::Contig const &contig = found->second;
+	unsigned hits = 0;
+
+	// records starting at or before pos
+	long j = std::upper_bound(contig.starts.begin(), contig.starts.end(), pos) - contig.starts.begin() - 1;
+
+	for (; j >= 0 && contig.maxEnds[j] >= pos; --j){
+		if (contig.ends[j] >= pos){
+			report(contig.records[j]);
+			++hits;
+		}
+	}
+
+	return hits;
+}
+
+// Run-length form of the positions covered by the reference regions of a family,
+// merged and sorted per contig. Replaces a genome sized bit mask per motif.
+struct TruthMask{
+	std::unordered_map<int, std::vector<std::pair<int, int> > > runs;
+	// number of distinct positions covered
+	uint64_t covered = 0;
+
+	bool contains(int contig, int pos) const {
+		auto found = runs.find(contig);
+
+		if (found == runs.end())
+			return false;
+
+		std::vector<std::pair<int, int> > const &contigRuns = found->second;
+		auto next = std::upper_bound(contigRuns.begin(), contigRuns.end(), std::make_pair(pos, std::numeric_limits<int>::max()));
+
+		return next != contigRuns.begin() && (next-1)->second >= pos;
+	}
+};
+
+TruthMask buildTruthMask(std::vector<RfamBenchRecord> const &refrec){
+	TruthMask truth;
+
+	for (RfamBenchRecord const &rec : refrec){
+		if (rec.start <= rec.end)
+			truth.runs[rec.ref_nr-1].push_back(std::make_pair(rec.start, rec.end));
+	}
+
+	for (auto &contig : truth.runs){
+		std::vector<std::pair<int, int> > &runs = contig.second;
+		std::sort(runs.begin(), runs.end());
+
+		// merge overlapping and adjacent runs
+		unsigned n = 0;
+		for (unsigned j=1; j < runs.size(); ++j){
+			if (runs[j].first <= runs[n].second+1){
+				runs[n].second = std::max(runs[n].second, runs[j].second);
+			}
+			else{
+				runs[++n] = runs[j];
+			}
+		}
+		runs.resize(n+1);
+
+		for (auto const &run : runs){
+			truth.covered += run.second - run.first + 1;
+		}
+	}
+
+	return truth;
+}
+
+// TSearchSpace is either a TBidirectionalIndex, a GapWildcardIndex, a HalfIndex,
+// a SeedNgramIndex, a PackedText for the online search or a MinimizerIndex
+template <typename TSearchSpace>
 //std::vector<TProfileInterval> getStemloopPositions(TBidirectionalIndex &index, Motif *motif, int threshold){
-std::vector<int> countStemloopHits(TBidirectionalIndex &index, Motif *motif, int seed_len, double freq_threshold, std::unordered_map<std::string, std::vector<RfamBenchRecord> > &refrecords){
+std::vector<int> countStemloopHits(TSearchSpace &index, Motif *motif, int seed_len, double freq_threshold, std::unordered_map<std::string, std::vector<RfamBenchRecord> > const &refrecords, SearchCache const &cache){
 	unsigned stems = motif->profile.size();
 
-	std::vector<RfamBenchRecord> &refrec = refrecords[motif->header.at("ID")];
+	// families without reference records only count negatives, the map is
+	// only read, so the families can be searched concurrently
+	static const std::vector<RfamBenchRecord> noRecords;
+	auto refIt = refrecords.find(motif->header.at("ID"));
+	std::vector<RfamBenchRecord> const &refrec = (refIt != refrecords.end()) ? refIt->second : noRecords;
 
 	std::cout << motif->header.at("ID") << " is being searched..\n";
 	std::cout << "RNA inserts: \n";
 
 	int true_bases = 0;
 
-	for (RfamBenchRecord &rec : refrec){
+	for (RfamBenchRecord const &rec : refrec){
 		std::cout << rec.seq_name << "\t" << rec.ref_nr << " : " << rec.start << "\t" << rec.end << "\n";
 		true_bases += (rec.end - rec.start + 1);
 	}
 
 	// set up stats counters
-	// the true negative is at the start each position
-	std::vector<std::vector<bool> > negatives;
+	// every position is a true negative unless it is covered by a reference
+	// region or was hit outside of one. Only the latter are stored, sparsely.
+	uint64_t genome_len = 0;
 	std::vector<std::vector<bool> > stemsFound(refrec.size(), std::vector<bool>(stems));
 
-	auto indText = seqan::indexText(index);
-
-	//std::cout << "Size: " << seqan::length(indText) << "\n";
-
-	for (unsigned i=0; i < seqan::length(indText); ++i){
-		int textLen = seqan::length(seqan::value(indText, i));
-		//std::cout << textLen << "?\n";
-		negatives.push_back(std::vector<bool>(textLen, true));
+	for (unsigned textLen : sequenceLengths(index)){
+		genome_len += textLen;
 	}
 
-	for (RfamBenchRecord &rec : refrec){
-		for (int i=rec.start; i <= rec.end; ++i){
-			negatives[rec.ref_nr-1][i] = false;
-		}
-	}
+	TruthMask truth = buildTruthMask(refrec);
+	ReferenceIntervals intervals = buildReferenceIntervals(refrec);
+
+	// hits of the current stem loop (many patterns hit the same loci)
+	// and the hits outside the truth regions of all stem loops
+	std::vector<std::pair<unsigned, unsigned> > stemHits;
+	std::vector<std::pair<unsigned, unsigned> > falsePositives;
 
 	for (unsigned i=0; i < stems; ++i){
 		TStructure &structure = motif->profile[i];
 
-		/*
-		int test_neg = 0;
-		for (unsigned i=0; i < negatives.size(); ++i){
-			// add all those who didn't change from true negative
-			int negatives_set = std::accumulate(negatives[i].begin(), negatives[i].end(), 0);
-			test_neg += negatives_set;
-		}
-
-		std::cout << test_neg << " -- " << true_bases << "\n";
-		*/
-
 		// start of the hairpin in the whole sequence
 		//std::cout <<  structure.pos.first << " " << structure.pos.second << ": " << motif->profile.size() << "\n";
 
+		stemHits.clear();
 
-		int struclen = structure.pos.second - structure.pos.first + 1;
-		int minSeed = std::min(struclen, seed_len);
-
-		MotifIterator<TBidirectionalIndex> iter(structure, index, minSeed, freq_threshold);
-
-		unsigned occ_sum   = 0;
-		unsigned pat_count = 0;
-
-		while (iter.next()){
-			++pat_count;
+		unsigned occ_sum = searchStemLoop(index, structure, i, seed_len, freq_threshold, cache,
+			[&](unsigned contig, unsigned pos, unsigned stem){
+				stemHits.push_back(std::make_pair(contig, pos));
+			});
 
-			unsigned occ_count = iter.countOccurrences();
-			auto occs = iter.getOccurrences();
-			occ_sum += occ_count;
+		std::sort(stemHits.begin(), stemHits.end());
+		stemHits.erase(std::unique(stemHits.begin(), stemHits.end()), stemHits.end());
 
-			//std::pair<int,int> pattern_pos = iter.patternPos();
+		for (auto const &hit : stemHits){
+			unsigned contig = hit.first;
+			unsigned pos = hit.second;
 
-			for (unsigned j=0; j < seqan::length(occs); ++j){
-				const TIndexPosType &pos = seqan::value(occs, j);
+			// mark the stem as found for every record whose region was hit
+			unsigned inMatchRegion = findReferenceRecords(intervals, contig, pos, [&](unsigned record){
+				stemsFound[record][i] = true;
+			});
 
-				int count = 0;
-				for (RfamBenchRecord &rec : refrec){
-					//verify that match region didn't get flagged
-
-					//std::cout << count << " " << i << " " << pos.i1 << " " << pos.i2 << "\n";
-					// matched in the right reference and in the right interval
-					bool inMatchRegion = (rec.ref_nr == (pos.i1-1)) && ( (rec.start <= pos.i2) && (pos.i2 <= rec.end) );
-					// if for this record the stem was not already found -> mark as found if we hit the right area
-					if (inMatchRegion){
-						stemsFound[count][i] = true;
-					}
-					// else if not in match region
-					else {
-						negatives[pos.i1][pos.i2] = false;
-					}
-
-					++count;
-				}
+			// outside the region of at least one record
+			if (inMatchRegion < refrec.size() && !truth.contains(contig, pos)){
+				falsePositives.push_back(hit);
 			}
 		}
 
-		std::cout << occ_sum << " matches seen\n";
+		std::cout << occ_sum << " matches seen, " << stemHits.size() << " unique\n";
 	}
 
+	std::sort(falsePositives.begin(), falsePositives.end());
+	falsePositives.erase(std::unique(falsePositives.begin(), falsePositives.end()), falsePositives.end());
+
 	// count stats
+	// positions flagged: the truth regions and the false positives outside of them
+	uint64_t flagged = truth.covered + falsePositives.size();
+
 	// true negatives are those who didn't get flagged as false positive (except the stem regions)
-	int tn = 0;
+	int tn = genome_len - flagged;
 	// false positives are the negatives flagged as false
-	int fp = 0;
-	for (unsigned i=0; i < negatives.size(); ++i){
-		// add all those who didn't change from true negative
-		int negatives_set = std::accumulate(negatives[i].begin(), negatives[i].end(), 0);
-		tn += negatives_set;
-		// add those who did change from true negative (to false positive)
-		fp += (negatives[i].size() - negatives_set);
-	}
-
-	fp -= true_bases;
+	int fp = (long)flagged - true_bases;
 
 	// true positives were the stem loops set in the correct regions
 	int tp = 0;
@@ -1468,51 +1915,165 @@ void countHits2(Motif *motif, std::vector<std::vector<bool> > hits, int aln_len,
 	//}
 }
 
+// frequency thresholds of the benchmark
+std::vector<double> benchmarkThresholds(){
+	return {0,0.02,0.04,0.06,0.08,0.1,0.12,0.14,0.16,0.18,0.2};
+}
+
+// Search structures of the target sequences shared by all families. They
+// are built once and only read during the search.
+struct FamilySearchSpace{
+	SearchCache cache;
+	// the packed text and the minimizer table
+	PackedText packed;
+	MinimizerIndex minimizers;
+	// FM index, its fibres are built once by the first search that misses
+	// the cache (see requireIndexFibres)
+	std::unique_ptr<TBidirectionalIndex> index;
+	std::once_flag index_fibres;
+};
+
 template <typename TStringType>
-std::vector<seqan::Tuple<int, 3> > findFamilyMatches(seqan::StringSet<TStringType> &seqs, std::vector<Motif*> &motifs,
-			std::unordered_map<std::string, std::vector<RfamBenchRecord> > &refrecords, AppOptions & options){
-	std::vector<seqan::Tuple<int, 3> > results;
+void initFamilySearchSpace(FamilySearchSpace &space, seqan::StringSet<TStringType> &seqs, AppOptions const &options){
+	if (!initSearchCache(space.cache, seqan::toCString(options.search_cache))){
+		std::cerr << "Can't use " << options.search_cache << " as search cache directory.\n";
+		space.cache.dir.clear();
+	}
 
-	//TBidirectionalIndex index(seqs);
+	if (space.cache.enabled()){
+		space.cache.text_fingerprint = textFingerprint(seqs);
+		space.cache.settings = options.online | (options.minimizer << 1) | (options.gap_wildcards << 2) | ((options.half_index > 0) << 3)
+							 | ((uint64_t)options.seed_order << 16) | ((uint64_t)options.seed_edits << 24);
+	}
 
-	std::vector<double> freqs = {0,0.02,0.04,0.06,0.08,0.1,0.12,0.14,0.16,0.18,0.2};
+	if (options.minimizer){
+		unsigned w = std::max(1, options.match_len - (int)options.minimizer_k + 1);
+		buildMinimizerIndex(space.minimizers, seqs, options.minimizer_k, w);
+		return;
+	}
+
+	if (options.online || options.half_index > 0){
+		packText(space.packed, seqs);
+	}
 
-	for (int k=0; k < freqs.size(); ++k){
-		std::stringstream fpath;
-		fpath << "stats_" << freqs[k] << ".txt";
+	// only the index object, the fibres are built when they are needed
+	if (!options.online){
+		space.index.reset(new TBidirectionalIndex(seqs));
+	}
+}
 
-		omp_lock_t writelock;
-		omp_init_lock(&writelock);
+// SeqAn builds the fibres lazily on the first search, which is not safe with
+// threads sharing the index. They are built here exactly once, up front of
+// the first search that is not served from the cache, so a run with all
+// hits in the cache never builds them.
+void requireIndexFibres(FamilySearchSpace &space, Motif *motif, SearchCache const &cache, double freq_threshold, AppOptions const &options){
+	bool cached = true;
+	for (TStructure const &structure : motif->profile)
+		cached = cached && hasCachedHits(cache, structure, options.match_len, freq_threshold);
 
-		#pragma omp parallel for schedule(dynamic)
-		for (unsigned i=0; i < motifs.size(); ++i){
-			Motif *motif = motifs[i];
+	if (cached)
+		return;
 
-			if (motif == 0)
-				continue;
+	std::call_once(space.index_fibres, [&space](){
+		seqan::indexRequire(space.index->fwd, seqan::FibreSALF());
+		seqan::indexRequire(space.index->rev, seqan::FibreSALF());
+	});
+}
 
-			std::cout << motif->header.at("ID") << "\n";
+// benchmark counts of one family for one frequency threshold
+std::vector<int> countFamilyHits(FamilySearchSpace &space, Motif *motif, double freq_threshold,
+			std::unordered_map<std::string, std::vector<RfamBenchRecord> > const &refrecords, AppOptions const &options){
+	if (options.minimizer)
+		return countStemloopHits(space.minimizers, motif, options.match_len, freq_threshold, refrecords, space.cache);
 
-			//std::cout << motif->seedAlignment << "\n";
-			TBidirectionalIndex index(seqs);
+	if (options.online)
+		return countStemloopHits(space.packed, motif, options.match_len, freq_threshold, refrecords, space.cache);
 
-			// find the locations of the motif matches
-			//std::cout << motif.header.at("AC") << "\n";
-			//std::vector<TProfileInterval> result = getStemloopPositions(index, motif, threshold);
-			std::vector<int> result = countStemloopHits(index, motif, options.match_len, freqs[k], refrecords);
+	// the hits of the seed n-gram search also depend on the seed rows
+	SearchCache cache = space.cache;
+	bool seeded_search = options.half_index == 0 && options.seed_order > 0;
+	if (cache.enabled() && seeded_search)
+		addSeedRows(cache, motif->seedAlignment);
 
-			omp_set_lock(&writelock);
-			std::ofstream fout;
-			fout.open(fpath.str(), std::ios_base::app | std::ios_base::out);
-			fout << motif->header.at("ID");
-			fout << "\t" << result[0] << "\t" << result[1] << "\t" << result[2] << "\t" << result[3] << "\t" << result[4] << "\n";
-			fout.close();
-			omp_unset_lock(&writelock);
-		}
+	requireIndexFibres(space, motif, cache, freq_threshold, options);
+	TBidirectionalIndex &index = *space.index;
+
+	if (options.half_index > 0){
+		HalfIndex<TBidirectionalIndex> half(index, space.packed, options.half_index);
+		return countStemloopHits(half, motif, options.match_len, freq_threshold, refrecords, cache);
+	}
+
+	if (seeded_search){
+		SeedNgramIndex<TBidirectionalIndex> seeded(index, motif->seedAlignment, options.seed_order, options.seed_edits);
+		return countStemloopHits(seeded, motif, options.match_len, freq_threshold, refrecords, cache);
+	}
+
+	if (options.gap_wildcards){
+		GapWildcardIndex<TBidirectionalIndex> gapped(index);
+		return countStemloopHits(gapped, motif, options.match_len, freq_threshold, refrecords, cache);
+	}
+
+	return countStemloopHits(index, motif, options.match_len, freq_threshold, refrecords, cache);
+}
+
+// Search one family at every benchmark threshold, shared by the phased run
+// and runFamilyPipeline(). Returns the countFamilyHits() result per threshold.
+std::vector<std::vector<int> > searchFamily(FamilySearchSpace &space, Motif *motif, std::vector<double> const &freqs,
+			std::unordered_map<std::string, std::vector<RfamBenchRecord> > const &refrecords, AppOptions const &options){
+	std::vector<std::vector<int> > results;
+
+	std::cout << motif->header.at("ID") << "\n";
+
+	for (size_t k=0; k < freqs.size(); ++k)
+		results.push_back(countFamilyHits(space, motif, freqs[k], refrecords, options));
+
+	return results;
+}
+
+// Write the benchmark report of the searched families, ids[i] belongs to
+// results[i], which is empty for a family that was not folded.
+void reportFamilies(FamilySearchSpace const &space, std::vector<double> const &freqs, std::vector<std::string> const &ids,
+			std::vector<std::vector<std::vector<int> > > const &results, AppOptions const &options){
+	if (options.minimizer)
+		printMinimizerStats(space.minimizers);
 
-		omp_destroy_lock(&writelock);
+	BenchmarkReport report(freqs, ids.size());
+
+	for (size_t i=0; i < ids.size(); ++i){
+		for (size_t k=0; k < results[i].size(); ++k)
+			recordMetrics(report, k, i, ids[i], results[i][k]);
 	}
 
+	writeBenchmarkReport(report, seqan::toCString(options.report_file));
+}
+
+template <typename TStringType>
+std::vector<seqan::Tuple<int, 3> > findFamilyMatches(seqan::StringSet<TStringType> &seqs, std::vector<Motif*> &motifs,
+			std::unordered_map<std::string, std::vector<RfamBenchRecord> > &refrecords, AppOptions & options){
+	std::vector<seqan::Tuple<int, 3> > results;
+
+	std::vector<double> freqs = benchmarkThresholds();
+
+	FamilySearchSpace space;
+	initFamilySearchSpace(space, seqs, options);
+
+	std::vector<std::string> ids(motifs.size());
+	std::vector<std::vector<std::vector<int> > > family_results(motifs.size());
+
+	#pragma omp parallel for schedule(dynamic)
+	for (unsigned i=0; i < motifs.size(); ++i){
+		Motif *motif = motifs[i];
+
+		if (motif == 0)
+			continue;
+
+		ids[i] = motif->header.at("ID");
+		// find the locations of the motif matches
+		family_results[i] = searchFamily(space, motif, freqs, refrecords, options);
+	}
+
+	reportFamilies(space, freqs, ids, family_results, options);
+
 	return results;
 }
 
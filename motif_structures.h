@@ -42,10 +42,12 @@
 #include "stockholm_file.h"
 
 // C++ headers
+#include <algorithm>
 #include <unordered_map>
 #include <unordered_set>
 #include <stack>
 #include <numeric>
+#include <limits>
 #include <memory>
 
 #ifndef NDEBUG
@@ -108,6 +110,10 @@ typedef seqan::Tag<RNALibFold__> RNALibFold;
 struct IPknotFold__;
 typedef seqan::Tag<IPknotFold__> IPknotFold;
 
+// no folding, the consensus structure annotated in the alignment is used
+struct AnnotationFold__;
+typedef seqan::Tag<AnnotationFold__> AnnotationFold;
+
 // From the Alphabet used (Dna, Rna), define a Binucleotide Alphabet and Profile strings.
 // Binucleotide alphabet: // AA, AC, AG, AT
 // Add one field to store gap characters.
@@ -203,6 +209,8 @@ struct Motif{
 
 	// the alignment structure of the seed RNA family
 	TAlign seedAlignment;
+	// profile weights of the rows, identical rows are collapsed into one
+	std::vector<unsigned> seedWeights;
 
 	// the profiles for the individual stem loops
 	TStemLoopProfile profile;
@@ -235,21 +243,52 @@ struct AppOptions
     // Verbosity level.  0 -- quiet, 1 -- normal, 2 -- verbose, 3 -- very verbose.
     int verbosity;
     int fold_length;
+    int max_bp_span;
+    int local_window;
+    int local_flank;
     int match_len;
+    unsigned batch_size;
     unsigned threads;
+    unsigned fold_workers;
+    unsigned fold_retries;
+    unsigned fold_rows;
+    unsigned samples;
     bool constrain;
     bool pseudoknot;
+    bool annotation;
+    bool annotation_probs;
+    bool sample_alternatives;
+    bool online;
+    bool reads;
+    bool minimizer;
+    bool gap_wildcards;
+    unsigned minimizer_k;
+    unsigned half_index;
+    unsigned seed_order;
+    unsigned seed_edits;
     double freq_threshold;
+    double max_gap_fraction;
 
     // The first (and only) argument of the program is stored here.
     seqan::CharString rna_file;
     seqan::CharString genome_file;
     seqan::CharString reference_file;
+    seqan::CharString search_cache;
+    seqan::CharString fold_cache;
+    seqan::CharString report_file;
+    seqan::CharString read_counts_file;
 
     AppOptions() :
         verbosity(1),
 		constrain(0),
-		pseudoknot(0)
+		pseudoknot(0),
+		annotation(0),
+		annotation_probs(0),
+		sample_alternatives(0),
+		online(0),
+		reads(0),
+		minimizer(0),
+		gap_wildcards(0)
     {}
 };
 
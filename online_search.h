@@ -0,0 +1,429 @@
+// ==========================================================================
+//                               online_search.h
+// ==========================================================================
+// Copyright (c) 2006-2016, Knut Reinert, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Knut Reinert or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL KNUT REINERT OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Your Name <your.email@example.net>
+// ==========================================================================
+
+// Index-free search of stem loops. The targets are kept as 2-bit packed text,
+// the hairpin-proximal part of a stem loop (at most 64 columns) is compiled
+// into a Shift-And automaton with optional characters (for the gapped columns
+// of the seed alignment) and every automaton match is verified position by
+// position over the whole seed, including the base pairs of the stems.
+// The automaton lets any subset of the optional columns be skipped, a
+// superset of the gap runs observed in the seed alignment; only the
+// verification is exact.
+
+#ifndef APPS_RNAMOTIF_ONLINE_SEARCH_H_
+#define APPS_RNAMOTIF_ONLINE_SEARCH_H_
+
+#include "motif_structures.h"
+
+// C++ headers
+#include <algorithm>
+#include <limits>
+#include <set>
+#include <vector>
+
+// ============================================================================
+// Forwards
+// ============================================================================
+
+// ============================================================================
+// Tags, Classes, Enums
+// ============================================================================
+
+// code for characters that are not A, C, G or U
+const unsigned UnknownBase = 4;
+
+/*!
+ * @class PackedText
+ *
+ * @brief 2-bit packed copy of a set of sequences.
+ *
+ *	32 bases are stored per 64 bit word, positions with an N are flagged
+ *	in a separate bit vector.
+ */
+
+struct PackedText{
+	std::vector<std::vector<uint64_t> > words;
+	std::vector<std::vector<uint64_t> > unknown;
+	std::vector<unsigned> lengths;
+
+	unsigned size() const {
+		return lengths.size();
+	}
+
+	// 2-bit code of the base at pos, UnknownBase for N
+	unsigned code(unsigned contig, unsigned pos) const {
+		if ((unknown[contig][pos >> 6] >> (pos & 63)) & 1)
+			return UnknownBase;
+
+		return (words[contig][pos >> 5] >> ((pos & 31) << 1)) & 3;
+	}
+};
+
+// One step of the pattern enumeration of a stem loop, in the same order
+// in which the StructureIterator generates them (hairpin outwards).
+struct StemLoopStep{
+	bool paired = false;
+	bool left = false;
+	// step may be skipped, the seed alignment has gaps here
+	bool optional = false;
+
+	// alignment columns covered by the step (-1 if unused)
+	int lcol = -1;
+	int rcol = -1;
+
+	// admissible 2-bit codes for single columns resp. both stem sides
+	uint8_t lmask = 0;
+	uint8_t rmask = 0;
+	// admissible base pairs, bit (l << 2 | r)
+	uint16_t pairs = 0;
+};
+
+struct StemLoopModel{
+	std::vector<StemLoopStep> steps;
+	// index of the first step of each structure element
+	std::vector<unsigned> elementOffset;
+};
+
+// ============================================================================
+// Metafunctions
+// ============================================================================
+
+// ============================================================================
+// Functions
+// ============================================================================
+
+template <typename TStringSet>
+void packText(PackedText &packed, TStringSet const &seqs){
+	unsigned n = seqan::length(seqs);
+
+	packed.words.assign(n, std::vector<uint64_t>());
+	packed.unknown.assign(n, std::vector<uint64_t>());
+	packed.lengths.assign(n, 0);
+
+	for (unsigned i=0; i < n; ++i){
+		auto const &seq = seqs[i];
+		unsigned len = seqan::length(seq);
+
+		packed.lengths[i] = len;
+		packed.words[i].assign((len >> 5) + 1, 0);
+		packed.unknown[i].assign((len >> 6) + 1, 0);
+
+		for (unsigned j=0; j < len; ++j){
+			unsigned c = seqan::ordValue(seq[j]);
+
+			if (c >= UnknownBase)
+				packed.unknown[i][j >> 6] |= (uint64_t)1 << (j & 63);
+			else
+				packed.words[i][j >> 5] |= (uint64_t)c << ((j & 31) << 1);
+		}
+	}
+}
+
+std::vector<unsigned> sequenceLengths(PackedText const &text){
+	return text.lengths;
+}
+
+template <typename TText, typename TSpec>
+std::vector<unsigned> sequenceLengths(seqan::Index<TText, TSpec> &index){
+	auto const &indText = seqan::indexText(index);
+	std::vector<unsigned> lengths;
+
+	for (unsigned i=0; i < seqan::length(indText); ++i){
+		lengths.push_back(seqan::length(seqan::value(indText, i)));
+	}
+
+	return lengths;
+}
+
+// mark the steps of an element that the StructureIterator may skip as gaps:
+// a gap run of length l starting at step k covers the steps k..k+l-1
+std::vector<bool> gappedSteps(StructureElement const &element, unsigned len){
+	std::vector<bool> gapped(len, false);
+
+	for (unsigned k=0; k < len && k < element.gap_lengths.size(); ++k){
+		for (auto const &gap : element.gap_lengths[k]){
+			for (unsigned t=k; t < k+gap.first && t < len; ++t){
+				gapped[t] = true;
+			}
+		}
+	}
+
+	return gapped;
+}
+
+// Compile the profile of a stem loop into enumeration steps. Characters are
+// admissible if they pass the same frequency threshold as in ProfileCharIterImpl.
+StemLoopModel compileStemLoop(TStructure const &structure, double freq_threshold){
+	StemLoopModel model;
+	model.elementOffset.resize(structure.elements.size());
+
+	for (int e = structure.elements.size()-1; e >= 0; --e){
+		StructureElement const &element = structure.elements[e];
+		unsigned len = seqan::length(element.loopComponents);
+		std::vector<bool> gapped = gappedSteps(element, len);
+
+		model.elementOffset[e] = model.steps.size();
+
+		for (unsigned k=0; k < len; ++k){
+			StemLoopStep step;
+			step.optional = gapped[k];
+
+			if (element.type == StructureType::STEM){
+				TBiAlphabetProfile const &pchar = element.stemProfile[k];
+				int threshold = (int)seqan::totalCount(pchar)*freq_threshold;
+
+				for (unsigned c=0; c < AlphabetSize*AlphabetSize; ++c){
+					unsigned l = c / AlphabetSize;
+					unsigned r = c % AlphabetSize;
+
+					if ((int)pchar.count[c] <= threshold || l >= UnknownBase || r >= UnknownBase)
+						continue;
+
+					step.pairs |= 1 << ((l << 2) | r);
+					step.lmask |= 1 << l;
+					step.rmask |= 1 << r;
+				}
+
+				// the innermost pair comes first
+				step.paired = true;
+				step.lcol = element.location + len-1-k;
+				step.rcol = structure.interactions[step.lcol];
+			}
+			else{
+				TAlphabetProfile const &pchar = element.loopComponents[k];
+				int threshold = (int)seqan::totalCount(pchar)*freq_threshold;
+
+				for (unsigned c=0; c < UnknownBase; ++c){
+					if ((int)pchar.count[c] > threshold)
+						step.lmask |= 1 << c;
+				}
+
+				step.rmask = step.lmask;
+				step.left = element.loopLeft;
+
+				// left sided profiles are stored reversed
+				if (element.loopLeft)
+					step.lcol = element.location + len-1-k;
+				else
+					step.rcol = element.location + k;
+			}
+
+			model.steps.push_back(step);
+		}
+	}
+
+	return model;
+}
+
+// number of characters a step adds to the pattern if it is not skipped
+inline unsigned stepLength(StemLoopStep const &step){
+	return step.paired ? 2 : 1;
+}
+
+// number of leading steps needed to cover the seed length with at most max_cols columns
+unsigned seedSteps(StemLoopModel const &model, unsigned minSeed, unsigned max_cols = std::numeric_limits<unsigned>::max()){
+	unsigned n_steps = 0, n_cols = 0;
+
+	while (n_steps < model.steps.size() && n_cols < minSeed && n_cols + stepLength(model.steps[n_steps]) <= max_cols){
+		n_cols += stepLength(model.steps[n_steps]);
+		++n_steps;
+	}
+
+	return n_steps;
+}
+
+// Match the steps [step, last) against the text. left is the next free text
+// position on the left side, right the one on the right side. Every complete
+// match of the text region [left+1, right) is reported.
+template <typename TReport>
+void verifySteps(StemLoopModel const &model, PackedText const &text, unsigned contig, unsigned step, unsigned last, long left, long right, TReport &report){
+	if (step == last){
+		report(left+1, right);
+		return;
+	}
+
+	StemLoopStep const &s = model.steps[step];
+	long len = text.lengths[contig];
+
+	if (s.optional)
+		verifySteps(model, text, contig, step+1, last, left, right, report);
+
+	if (s.paired){
+		if (left < 0 || right >= len)
+			return;
+
+		unsigned l = text.code(contig, left);
+		unsigned r = text.code(contig, right);
+
+		if (l != UnknownBase && r != UnknownBase && ((s.pairs >> ((l << 2) | r)) & 1))
+			verifySteps(model, text, contig, step+1, last, left-1, right+1, report);
+	}
+	else if (s.left){
+		if (left < 0)
+			return;
+
+		unsigned l = text.code(contig, left);
+
+		if (l != UnknownBase && ((s.lmask >> l) & 1))
+			verifySteps(model, text, contig, step+1, last, left-1, right, report);
+	}
+	else{
+		if (right >= len)
+			return;
+
+		unsigned r = text.code(contig, right);
+
+		if (r != UnknownBase && ((s.rmask >> r) & 1))
+			verifySteps(model, text, contig, step+1, last, left, right+1, report);
+	}
+}
+
+// Scan the text with a Shift-And automaton (with optional characters as in
+// Navarro & Raffinot) built from the first steps of the stem loop, until the
+// seed length is reached or 64 columns are used. Automaton matches are verified
+// with verifySteps() for all steps of the seed, as many as the index search
+// uses, and reported as delegate(contig, start, stem_id).
+template <typename TDelegate>
+unsigned searchStemLoop(PackedText &text, TStructure &structure, unsigned stem_id, int seed_len, double freq_threshold, TDelegate &&delegate){
+	StemLoopModel model = compileStemLoop(structure, freq_threshold);
+
+	int struclen = structure.pos.second - structure.pos.first + 1;
+	unsigned minSeed = std::min(struclen, seed_len);
+
+	unsigned n_steps = seedSteps(model, minSeed);
+	// the automaton only filters on the steps that fit into 64 columns
+	unsigned n_filter = seedSteps(model, minSeed, 64);
+
+	if (n_filter == 0)
+		return 0;
+
+	// columns of the seed outside of the filter
+	unsigned n_outer = 0;
+	for (unsigned i=n_filter; i < n_steps; ++i)
+		n_outer += stepLength(model.steps[i]);
+
+	// lay the columns out in text order
+	typedef std::pair<int, std::pair<uint8_t, bool> > TColumn;
+	std::vector<TColumn> columns;
+
+	for (unsigned i=0; i < n_filter; ++i){
+		StemLoopStep const &s = model.steps[i];
+
+		if (s.lcol != -1)
+			columns.push_back(std::make_pair(s.lcol, std::make_pair(s.lmask, s.optional)));
+		if (s.rcol != -1)
+			columns.push_back(std::make_pair(s.rcol, std::make_pair(s.rmask, s.optional)));
+	}
+
+	std::sort(columns.begin(), columns.end());
+
+	unsigned m = columns.size();
+	uint64_t B[UnknownBase+1] = {0, 0, 0, 0, 0};
+	uint64_t A = 0, I = 0, F = 0, lead = 0;
+
+	for (unsigned j=0; j < m; ++j){
+		for (unsigned c=0; c < UnknownBase; ++c){
+			if ((columns[j].second.first >> c) & 1)
+				B[c] |= (uint64_t)1 << j;
+		}
+
+		if (!columns[j].second.second)
+			continue;
+
+		// optional columns before the first mandatory one can always be skipped
+		if (j == 0 || lead == (((uint64_t)1 << j) - 1)){
+			lead |= (uint64_t)1 << j;
+			continue;
+		}
+
+		A |= (uint64_t)1 << j;
+
+		// start of a block of optional columns, mark the preceding column
+		if (!((A >> (j-1)) & 1))
+			I |= (uint64_t)1 << (j-1);
+		// end of a block
+		if (j == m-1 || !columns[j+1].second.second)
+			F |= (uint64_t)1 << j;
+	}
+
+	uint64_t final_bit = (uint64_t)1 << (m-1);
+	unsigned occ_sum = 0;
+
+	for (unsigned contig=0; contig < text.size(); ++contig){
+		uint64_t D = 0;
+		long len = text.lengths[contig];
+
+		// starts reported recently, to avoid reporting a window twice
+		std::set<long> reported;
+
+		for (long e=0; e < len; ++e){
+			D = (((D << 1) | 1) & B[text.code(contig, e)]) | lead;
+			uint64_t Df = D | F;
+			D |= A & ((~(Df - I)) ^ Df);
+
+			if (!(D & final_bit))
+				continue;
+
+			// verify for every possible start of the hairpin in the window, the
+			// filter steps have to end at e, the rest of the seed extends them
+			std::vector<long> starts;
+			auto report = [&](long start, long end){
+				starts.push_back(start);
+			};
+			auto filtered = [&](long start, long end){
+				if (end == e+1)
+					verifySteps(model, text, contig, n_filter, n_steps, start-1, end, report);
+			};
+
+			for (long h = std::max(0L, e-(long)m+1); h <= e+1; ++h){
+				verifySteps(model, text, contig, 0, n_filter, h-1, h, filtered);
+			}
+
+			for (long start : starts){
+				if (reported.insert(start).second){
+					delegate(contig, start, stem_id);
+					++occ_sum;
+				}
+			}
+
+			// forget starts that can't be reached again
+			while (!reported.empty() && *reported.begin() < e - 2*(long)(m + n_outer))
+				reported.erase(reported.begin());
+		}
+	}
+
+	return occ_sum;
+}
+
+#endif  // #ifndef APPS_RNAMOTIF_ONLINE_SEARCH_H_
@@ -0,0 +1,190 @@
+// ==========================================================================
+//                               read_search.h
+// ==========================================================================
+// Copyright (c) 2006-2016, Knut Reinert, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Knut Reinert or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL KNUT REINERT OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Your Name <your.email@example.net>
+// ==========================================================================
+
+
+// Screening of sequencing reads for family content. The reads are consumed
+// in batches of bounded size, every batch is searched for all stem loops of
+// all motifs and only the per-family counters survive the batch, so the
+// memory stays flat independent of the number of reads in the file.
+
+#ifndef APPS_RNAMOTIF_READ_SEARCH_H_
+#define APPS_RNAMOTIF_READ_SEARCH_H_
+
+#include "motif_structures.h"
+#include "motif_search.h"
+
+// SeqAn headers
+#include <seqan/seq_io.h>
+
+// openMP
+#include <omp.h>
+
+// C++ headers
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <vector>
+
+// ============================================================================
+// Forwards
+// ============================================================================
+
+// ============================================================================
+// Tags, Classes, Enums
+// ============================================================================
+
+struct FamilyReadCounts{
+	// reads with a hit of at least one stem loop of the family
+	uint64_t reads = 0;
+	// distinct (read, start) hits of all stem loops
+	uint64_t hits = 0;
+};
+
+// ============================================================================
+// Metafunctions
+// ============================================================================
+
+// ============================================================================
+// Functions
+// ============================================================================
+
+// Search all stem loops of a motif in one batch of reads. A hit is counted
+// once per (read, start) and stem loop, the index search reports the same
+// position for every pattern that matches there.
+template <typename TSearchSpace>
+void countBatchHits(FamilyReadCounts &counts, TSearchSpace &batch, unsigned n_reads, Motif *motif, int seed_len, double freq_threshold){
+	std::vector<bool> readHit(n_reads, false);
+
+	for (unsigned i=0; i < motif->profile.size(); ++i){
+		std::set<std::pair<unsigned, unsigned> > hits;
+
+		searchStemLoop(batch, motif->profile[i], i, seed_len, freq_threshold,
+			[&](unsigned contig, unsigned pos, unsigned stem){
+				readHit[contig] = true;
+				hits.insert(std::make_pair(contig, pos));
+			});
+
+		counts.hits += hits.size();
+	}
+
+	counts.reads += std::accumulate(readHit.begin(), readHit.end(), (uint64_t)0);
+}
+
+// the FM index fibres are built lazily on the first search, build them up front
+// so the threads can share the index of a batch
+void prepareBatchIndex(TBidirectionalIndex &index){
+	seqan::indexRequire(index.fwd, seqan::FibreSALF());
+	seqan::indexRequire(index.rev, seqan::FibreSALF());
+}
+
+// Read the reads file in batches of options.batch_size records and count the
+// reads hit by every motif. The counts are written to options.read_counts_file.
+std::vector<FamilyReadCounts> screenReads(std::vector<Motif*> &motifs, AppOptions &options){
+	std::vector<FamilyReadCounts> counts(motifs.size());
+
+	seqan::SeqFileIn seqFileIn;
+	if (!seqan::open(seqFileIn, seqan::toCString(options.genome_file))){
+		std::cerr << "Can't open read file " << options.genome_file << "\n";
+		return counts;
+	}
+
+	seqan::StringSet<seqan::CharString> ids;
+	seqan::StringSet<seqan::String<TBaseAlphabet> > reads;
+
+	uint64_t n_reads = 0;
+	unsigned n_batches = 0;
+
+	while (!seqan::atEnd(seqFileIn)){
+		seqan::clear(ids);
+		seqan::clear(reads);
+
+		seqan::readRecords(ids, reads, seqFileIn, options.batch_size);
+
+		unsigned batch_len = seqan::length(reads);
+		if (batch_len == 0)
+			break;
+
+		n_reads += batch_len;
+		++n_batches;
+
+		if (options.online){
+			PackedText packed;
+			packText(packed, reads);
+
+			#pragma omp parallel for schedule(dynamic)
+			for (unsigned i=0; i < motifs.size(); ++i){
+				if (motifs[i] == 0)
+					continue;
+
+				countBatchHits(counts[i], packed, batch_len, motifs[i], options.match_len, options.freq_threshold);
+			}
+		}
+		else{
+			TBidirectionalIndex index(reads);
+			prepareBatchIndex(index);
+
+			#pragma omp parallel for schedule(dynamic)
+			for (unsigned i=0; i < motifs.size(); ++i){
+				if (motifs[i] == 0)
+					continue;
+
+				countBatchHits(counts[i], index, batch_len, motifs[i], options.match_len, options.freq_threshold);
+			}
+		}
+
+		if (options.verbosity > 1)
+			std::cout << "Batch " << n_batches << ": " << n_reads << " reads searched\n";
+	}
+
+	std::cout << "Searched " << n_reads << " reads in " << n_batches << " batches\n";
+
+	std::ofstream fout(seqan::toCString(options.read_counts_file));
+	if (!fout){
+		std::cerr << "Can't write the read counts to " << options.read_counts_file << "\n";
+		return counts;
+	}
+
+	fout << "#ID\treads\thits\ttotal\n";
+
+	for (unsigned i=0; i < motifs.size(); ++i){
+		if (motifs[i] == 0)
+			continue;
+
+		fout << motifs[i]->header.at("ID") << "\t" << counts[i].reads << "\t" << counts[i].hits << "\t" << n_reads << "\n";
+	}
+
+	return counts;
+}
+
+#endif  // #ifndef APPS_RNAMOTIF_READ_SEARCH_H_
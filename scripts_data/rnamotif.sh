@@ -13,8 +13,11 @@ counter= 0
   #echo "put ${filename}"
 #   done
 #   echo "$counter"
-declare -a arr=("stats_0" "stats_0.02" "stats_0.04" "stats_0.06" "stats_0.08" "stats_0.1" "stats_0.12" "stats_0.14" "stats_0.16" "stats_0.18" "stats_0.2")
-echo "move files..."
+echo "run families..."
+
+# RNAMotif writes one report per family with a row for every stat profile
+report_dir=~/server_results/likeMaster/reports
+mkdir -p "$report_dir"
 
 for full in ~/gen_pos/*; do
   echo "${full##*/} gets processed"
@@ -22,24 +25,10 @@ for full in ~/gen_pos/*; do
   filename="${full##*/}"
   # filename="${filename%.*}"
   # echo "$full"/"$filename"
-  # create result dict
-  # cd "$full" && mkdir results -> done
-
-  # execute RNAMotif for all families
-#  cd ~/server_results/likeMaster/ || exit
-# ~/server_results/likeMaster/./RNAMotif
 
   cd ~/server_results/likeMaster/ || exit
 
-  ~/server_results/likeMaster/./RNAMotif "$full"/"$filename".msa "$full"/"$filename".fa -r "$full"/"$filename".pos
-  for filter in "${arr[@]}"; do
-    #mv "$filter".txt "$full"/results
-    # shellcheck disable=SC2046
-    # RNAMotif creates for each Family for every stat profile one output file in the current dir
-    # move them into their desired folder
-    mv  ~/server_results/likeMaster/*"$filter".txt ~/server_results/likeMaster/"$filter"
-
-  done
+  ~/server_results/likeMaster/./RNAMotif "$full"/"$filename".msa "$full"/"$filename".fa -r "$full"/"$filename".pos -o "$report_dir"/"$filename".tsv
 
 done
 # calculuate spec and sens for each family and plot average over all for each stat profile-> safe fig
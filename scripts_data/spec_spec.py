@@ -15,35 +15,37 @@ def means(lst):
     return sum(lst) / len(lst)
 
 
-dir_names = ["stats_0", "stats_0.02", "stats_0.04", "stats_0.06", "stats_0.08", "stats_0.1", "stats_0.12", "stats_0.14",
-             "stats_0.16", "stats_0.18", "stats_0.2"]
 home = os.path.expanduser("~")
 plot_dir = " "
 dir_to_res_path = home+ '/server_results/likeMaster/'
-spec_dict = {key: 0 for key in dir_names}
-sens_dict = {key: 0 for key in dir_names}
-
-# over all stats dirs
-for s_dir in dir_names:
-
-    spec_list, sens_list = [], []
-    # over all files in stats dirs
-    stat_dir = os.path.join(dir_to_res_path, s_dir)
-    print(stat_dir)
-    for file in os.listdir(stat_dir):
-        # open file - else quit programm
-        if file.endswith(".txt"):
-            with open(os.path.join(stat_dir, file), 'r') as stat_file:
-                lines = stat_file.readlines()
-                for line in lines:
-                    nums = [int(i) for i in line.split() if i.isnumeric()]
-                    # [tn, fp, tp ,fn, refrecsize]
-                    spec_list.append(spec(nums[0], nums[1]))
-                    sens_list.append(sens(nums[2], nums[3]))
-                    sens_dict[s_dir] = means(sens_list)
-                    spec_dict[s_dir] = means(spec_list)
-        else:
-            sys.exit("UNKWOWN FILE TYPE")
+report_dir = os.path.join(dir_to_res_path, 'reports')
+
+# per stat profile (frequency threshold): sensitivities and specificities of all families
+spec_lists, sens_lists = {}, {}
+
+# over all family reports, columns:
+# ID freq TN FP TP FN refs sensitivity specificity MCC
+for file in sorted(os.listdir(report_dir)):
+    if not file.endswith(".tsv"):
+        sys.exit("UNKWOWN FILE TYPE")
+
+    with open(os.path.join(report_dir, file), 'r') as report:
+        for line in report:
+            if line.startswith('#'):
+                continue
+
+            cols = line.split('\t')
+            freq = float(cols[1])
+            tn, fp, tp, fn = [int(i) for i in cols[2:6]]
+
+            spec_lists.setdefault(freq, []).append(spec(tn, fp))
+            sens_lists.setdefault(freq, []).append(sens(tp, fn))
+
+freqs = sorted(spec_lists)
+# labels as the former stats_<freq> directories: stats_0, stats_0.02, ..., stats_0.2
+dir_names = ["stats_%g" % f for f in freqs]
+spec_dict = {name: means(spec_lists[f]) for name, f in zip(dir_names, freqs)}
+sens_dict = {name: means(sens_lists[f]) for name, f in zip(dir_names, freqs)}
 
 
 
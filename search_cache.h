@@ -0,0 +1,335 @@
+// ==========================================================================
+//                               search_cache.h
+// ==========================================================================
+// Copyright (c) 2006-2016, Knut Reinert, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Knut Reinert or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL KNUT REINERT OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Your Name <your.email@example.net>
+// ==========================================================================
+
+// On-disk cache for the hits of single stem loops. Every cache file is named
+// after a hash of everything the search result depends on (the stem loop
+// profile, the frequency threshold, the seed length, the searched text and
+// for the seed n-gram search the seed rows), so changing any of the inputs
+// simply leads to a different file.
+
+#ifndef APPS_RNAMOTIF_SEARCH_CACHE_H_
+#define APPS_RNAMOTIF_SEARCH_CACHE_H_
+
+#include "motif_structures.h"
+
+// openMP
+#include <omp.h>
+
+// C++ headers
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// POSIX headers
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// ============================================================================
+// Forwards
+// ============================================================================
+
+// ============================================================================
+// Tags, Classes, Enums
+// ============================================================================
+
+// bump whenever the file layout or the meaning of the cached hits changes
+const uint32_t SearchCacheVersion = 1;
+const char SearchCacheMagic[4] = {'R', 'M', 'S', 'C'};
+
+const uint64_t FNVOffset = 14695981039346656037ULL;
+const uint64_t FNVPrime  = 1099511628211ULL;
+
+typedef std::vector<std::pair<unsigned, unsigned> > TCachedHits;
+
+struct SearchCache{
+	// directory holding the cache files, caching is disabled if empty
+	std::string dir;
+	// hash over the searched sequences
+	uint64_t text_fingerprint = 0;
+	// hash over the search settings that change the reported hits
+	uint64_t settings = 0;
+
+	bool enabled() const {
+		return !dir.empty();
+	}
+
+	std::string path(uint64_t key) const {
+		std::stringstream ss;
+		ss << dir << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".hits";
+		return ss.str();
+	}
+};
+
+// ============================================================================
+// Metafunctions
+// ============================================================================
+
+// ============================================================================
+// Functions
+// ============================================================================
+
+// FNV-1a over raw bytes
+inline void fnvHash(uint64_t &hash, const void *data, size_t n){
+	const unsigned char *bytes = static_cast<const unsigned char*>(data);
+
+	for (size_t i=0; i < n; ++i){
+		hash ^= bytes[i];
+		hash *= FNVPrime;
+	}
+}
+
+template <typename T>
+inline void fnvHashValue(uint64_t &hash, T const &value){
+	fnvHash(hash, &value, sizeof(T));
+}
+
+template <typename TProfileString>
+void hashProfileString(uint64_t &hash, TProfileString const &profile){
+	typedef typename seqan::Value<TProfileString>::Type TProfileChar;
+	const unsigned size = seqan::ValueSize<TProfileChar>::VALUE;
+
+	fnvHashValue(hash, (uint64_t)seqan::length(profile));
+
+	for (unsigned i=0; i < seqan::length(profile); ++i){
+		for (unsigned c=0; c < size; ++c){
+			fnvHashValue(hash, (uint64_t)profile[i].count[c]);
+		}
+	}
+}
+
+// hash everything of a stem loop that influences the patterns generated from it
+uint64_t hashStemLoopProfile(TStructure const &structure){
+	uint64_t hash = FNVOffset;
+
+	fnvHashValue(hash, (int)structure.btype);
+	fnvHashValue(hash, structure.pos.first);
+	fnvHashValue(hash, structure.pos.second);
+
+	for (StructureElement const &element : structure.elements){
+		fnvHashValue(hash, (int)element.type);
+		fnvHashValue(hash, element.loopLeft);
+		fnvHashValue(hash, element.location);
+		fnvHashValue(hash, element.statistics.min_length);
+		fnvHashValue(hash, element.statistics.max_length);
+
+		hashProfileString(hash, element.loopComponents);
+		hashProfileString(hash, element.stemProfile);
+
+		for (std::map<int, int> const &gaps : element.gap_lengths){
+			fnvHashValue(hash, (uint64_t)gaps.size());
+
+			for (auto const &gap : gaps){
+				fnvHashValue(hash, gap.first);
+				fnvHashValue(hash, gap.second);
+			}
+		}
+	}
+
+	return hash;
+}
+
+// fingerprint of the searched text: number of sequences, their lengths and contents
+template <typename TStringSet>
+uint64_t textFingerprint(TStringSet const &seqs){
+	uint64_t hash = FNVOffset;
+
+	fnvHashValue(hash, (uint64_t)seqan::length(seqs));
+
+	for (unsigned i=0; i < seqan::length(seqs); ++i){
+		auto const &seq = seqs[i];
+		fnvHashValue(hash, (uint64_t)seqan::length(seq));
+
+		for (unsigned j=0; j < seqan::length(seq); ++j){
+			hash ^= seqan::ordValue(seq[j]);
+			hash *= FNVPrime;
+		}
+	}
+
+	return hash;
+}
+
+// Mix the rows of the seed alignment, gaps included, into the settings of
+// the cache. Needed for searches that depend on the seed rows and not only
+// on the stem loop profile (the seed n-gram model).
+void addSeedRows(SearchCache &cache, TAlign &align){
+	uint64_t hash = FNVOffset;
+	fnvHashValue(hash, cache.settings);
+	fnvHashValue(hash, (uint64_t)seqan::length(seqan::rows(align)));
+
+	for (unsigned r=0; r < seqan::length(seqan::rows(align)); ++r){
+		TRow &row = seqan::row(align, r);
+		fnvHashValue(hash, (uint64_t)seqan::length(row));
+
+		for (unsigned col=0; col < seqan::length(row); ++col){
+			uint8_t c = seqan::isGap(row, col) ? 0xff : (uint8_t)seqan::ordValue(row[col]);
+			fnvHashValue(hash, c);
+		}
+	}
+
+	cache.settings = hash;
+}
+
+uint64_t searchCacheKey(SearchCache const &cache, TStructure const &structure, int seed_len, double freq_threshold){
+	uint64_t hash = FNVOffset;
+
+	fnvHashValue(hash, SearchCacheVersion);
+	fnvHashValue(hash, hashStemLoopProfile(structure));
+	fnvHashValue(hash, seed_len);
+	fnvHashValue(hash, freq_threshold);
+	fnvHashValue(hash, cache.text_fingerprint);
+	fnvHashValue(hash, cache.settings);
+
+	return hash;
+}
+
+// create a cache directory if it does not exist yet
+bool createCacheDirectory(std::string const &dir){
+	struct stat st;
+	if (stat(dir.c_str(), &st) == 0)
+		return S_ISDIR(st.st_mode);
+
+	return mkdir(dir.c_str(), 0755) == 0;
+}
+
+bool initSearchCache(SearchCache &cache, std::string const &dir){
+	cache.dir = dir;
+
+	if (!cache.enabled())
+		return true;
+
+	return createCacheDirectory(dir);
+}
+
+// bytes left in the file after the current position, to check the sizes
+// stored in a file before allocating for them
+uint64_t remainingBytes(std::ifstream &fin){
+	std::streampos pos = fin.tellg();
+	fin.seekg(0, std::ios::end);
+	std::streampos end = fin.tellg();
+	fin.seekg(pos);
+
+	if (!fin || pos < 0 || end < pos)
+		return 0;
+
+	return end - pos;
+}
+
+// whether the cache holds a file for the stem loop, without reading it
+bool hasCachedHits(SearchCache const &cache, TStructure const &structure, int seed_len, double freq_threshold){
+	if (!cache.enabled())
+		return false;
+
+	struct stat st;
+	return stat(cache.path(searchCacheKey(cache, structure, seed_len, freq_threshold)).c_str(), &st) == 0;
+}
+
+// read a cache file, returns false if it is missing or does not belong to the key
+bool readCachedHits(TCachedHits &hits, std::string const &path, uint64_t key){
+	std::ifstream fin(path, std::ios::binary);
+
+	if (!fin)
+		return false;
+
+	char magic[4];
+	uint32_t version;
+	uint64_t file_key, n;
+
+	fin.read(magic, 4);
+	fin.read(reinterpret_cast<char*>(&version), sizeof(version));
+	fin.read(reinterpret_cast<char*>(&file_key), sizeof(file_key));
+	fin.read(reinterpret_cast<char*>(&n), sizeof(n));
+
+	if (!fin || std::memcmp(magic, SearchCacheMagic, 4) != 0 || version != SearchCacheVersion || file_key != key)
+		return false;
+
+	// truncated or damaged file, don't trust n
+	if (n > remainingBytes(fin) / (2*sizeof(uint32_t)))
+		return false;
+
+	std::vector<uint32_t> buffer(2*n);
+	fin.read(reinterpret_cast<char*>(buffer.data()), buffer.size()*sizeof(uint32_t));
+
+	// truncated file
+	if (!fin)
+		return false;
+
+	hits.clear();
+	hits.reserve(n);
+
+	for (uint64_t i=0; i < n; ++i){
+		hits.push_back(std::make_pair(buffer[2*i], buffer[2*i+1]));
+	}
+
+	return true;
+}
+
+// write into a temporary file first and rename it afterwards, so concurrent
+// readers either see the complete file or none at all
+bool writeCachedHits(TCachedHits const &hits, std::string const &path, uint64_t key){
+	std::stringstream tmp_path;
+	tmp_path << path << ".tmp." << getpid() << "." << omp_get_thread_num();
+
+	{
+		std::ofstream fout(tmp_path.str(), std::ios::binary | std::ios::trunc);
+
+		if (!fout)
+			return false;
+
+		uint64_t n = hits.size();
+
+		fout.write(SearchCacheMagic, 4);
+		fout.write(reinterpret_cast<const char*>(&SearchCacheVersion), sizeof(SearchCacheVersion));
+		fout.write(reinterpret_cast<const char*>(&key), sizeof(key));
+		fout.write(reinterpret_cast<const char*>(&n), sizeof(n));
+
+		for (auto const &hit : hits){
+			uint32_t pair[2] = {hit.first, hit.second};
+			fout.write(reinterpret_cast<const char*>(pair), sizeof(pair));
+		}
+
+		if (!fout){
+			std::remove(tmp_path.str().c_str());
+			return false;
+		}
+	}
+
+	return std::rename(tmp_path.str().c_str(), path.c_str()) == 0;
+}
+
+#endif  // #ifndef APPS_RNAMOTIF_SEARCH_CACHE_H_
@@ -0,0 +1,156 @@
+// ==========================================================================
+//                                seed_ngram.h
+// ==========================================================================
+// Copyright (c) 2006-2016, Knut Reinert, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Knut Reinert or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL KNUT REINERT OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Your Name <your.email@example.net>
+// ==========================================================================
+
+
+// k-th order model of the seed rows of a stem loop. For every enumeration
+// step it stores which symbols followed which k preceding symbols in the rows
+// of the seed alignment, so the search only generates extensions that were
+// actually observed instead of the product of the admissible column characters.
+
+#ifndef APPS_RNAMOTIF_SEED_NGRAM_H_
+#define APPS_RNAMOTIF_SEED_NGRAM_H_
+
+#include "motif_structures.h"
+#include "online_search.h"
+
+// C++ headers
+#include <unordered_set>
+#include <vector>
+
+// ============================================================================
+// Forwards
+// ============================================================================
+
+// ============================================================================
+// Tags, Classes, Enums
+// ============================================================================
+
+// step symbols: 2-bit codes for single columns, (l << 2 | r) for base pairs,
+// a gap if the step was skipped and unknown for N or half gapped pairs
+const unsigned SeedGapSymbol     = 16;
+const unsigned SeedUnknownSymbol = 31;
+const unsigned SeedSymbolBits    = 5;
+// the (context, symbol) keys take SeedSymbolBits*(order+1) bits of 64
+const unsigned MaxSeedOrder      = 64/SeedSymbolBits - 1;
+
+struct SeedNgramModel{
+	unsigned order = 0;
+	// observed (context, symbol) keys for every step
+	std::vector<std::unordered_set<uint64_t> > observed;
+
+	uint64_t contextMask() const {
+		return ((uint64_t)1 << (SeedSymbolBits*order)) - 1;
+	}
+
+	// context after appending symbol
+	uint64_t extend(uint64_t context, unsigned symbol) const {
+		return ((context << SeedSymbolBits) | symbol) & contextMask();
+	}
+
+	bool seen(unsigned step, uint64_t context, unsigned symbol) const {
+		return observed[step].count((context << SeedSymbolBits) | symbol) > 0;
+	}
+};
+
+// ============================================================================
+// Metafunctions
+// ============================================================================
+
+// ============================================================================
+// Functions
+// ============================================================================
+
+// symbol of an alignment row at one step of the model
+unsigned seedRowSymbol(TRow &row, StemLoopStep const &step){
+	auto column = [&](int col) -> unsigned {
+		if (seqan::isGap(row, col))
+			return SeedGapSymbol;
+
+		unsigned c = seqan::ordValue(row[col]);
+		return c < UnknownBase ? c : SeedUnknownSymbol;
+	};
+
+	if (step.paired){
+		unsigned l = column(step.lcol);
+		unsigned r = column(step.rcol);
+
+		if (l == SeedGapSymbol && r == SeedGapSymbol)
+			return SeedGapSymbol;
+		if (l >= UnknownBase || r >= UnknownBase)
+			return SeedUnknownSymbol;
+
+		return (l << 2) | r;
+	}
+
+	return column(step.lcol != -1 ? step.lcol : step.rcol);
+}
+
+// Build the model of order k for the steps [0, n_steps) from all rows of the
+// seed alignment. Windows with unknown symbols are not recorded.
+SeedNgramModel buildSeedNgramModel(TAlign &align, StemLoopModel const &model, unsigned n_steps, unsigned order){
+	SeedNgramModel ngrams;
+	ngrams.order = std::min(order, MaxSeedOrder);
+	ngrams.observed.resize(n_steps);
+
+	for (unsigned r=0; r < seqan::length(seqan::rows(align)); ++r){
+		TRow &row = seqan::row(align, r);
+
+		std::vector<unsigned> symbols(n_steps);
+		for (unsigned i=0; i < n_steps; ++i){
+			symbols[i] = seedRowSymbol(row, model.steps[i]);
+		}
+
+		uint64_t context = 0;
+		// steps since the last unknown symbol
+		unsigned clean = 0;
+
+		for (unsigned i=0; i < n_steps; ++i){
+			if (symbols[i] == SeedUnknownSymbol){
+				clean = 0;
+				context = ngrams.extend(context, 0);
+				continue;
+			}
+
+			if (clean >= std::min(i, ngrams.order))
+				ngrams.observed[i].insert((context << SeedSymbolBits) | symbols[i]);
+
+			context = ngrams.extend(context, symbols[i]);
+			++clean;
+		}
+	}
+
+	return ngrams;
+}
+
+#endif  // #ifndef APPS_RNAMOTIF_SEED_NGRAM_H_